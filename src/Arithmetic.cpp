@@ -0,0 +1,328 @@
+#include "Arithmetic.h"
+#include "Executor.h"
+#include <cctype>
+#include <string>
+
+using std::string;
+using std::string_view;
+
+/* for the <cctype> functions, which are undefined for negative chars */
+static unsigned char byte(char c) { return static_cast<unsigned char>(c); }
+
+namespace {
+    struct BinaryOperator {
+        string_view text;
+        int precedence;
+    };
+
+    /* longest operators first, so that e.g. '<<' isn't taken for '<' */
+    const BinaryOperator kBinaryOperators[] = {
+        {"**", 11},
+        {"<<", 8}, {">>", 8},
+        {"<=", 7}, {">=", 7},
+        {"==", 6}, {"!=", 6},
+        {"&&", 2}, {"||", 1},
+        {"*", 10}, {"/", 10}, {"%", 10},
+        {"+", 9}, {"-", 9},
+        {"<", 7}, {">", 7},
+        {"&", 5}, {"^", 4}, {"|", 3},
+    };
+
+    const string_view kAssignmentOperators[] = {
+        "<<=", ">>=", "*=", "/=", "%=", "+=", "-=", "&=", "^=", "|=", "=",
+    };
+
+    /* variables whose values refer to each other can't nest deeper */
+    const int kMaxDepth = 64;
+}
+
+int64_t Arithmetic::evaluate()
+{
+    skip_blanks();
+    if (_pos == _input.size()) return 0;
+    int64_t value = parse_comma();
+    skip_blanks();
+    if (_pos != _input.size()) syntax_error();
+    return value;
+}
+
+/**
+ * Apply a binary operator. Addition, subtraction, multiplication, and left
+ * shifts wrap around (they are done on unsigned values); shift counts are
+ * taken modulo 64.
+ */
+static int64_t apply(string_view op, int64_t a, int64_t b, bool skipping)
+{
+    uint64_t ua = a, ub = b;
+    switch (op[0]) {
+        case '+': return ua + ub;
+        case '-': return ua - ub;
+        case '*':
+            if (op == "**") {
+                if (b < 0) {
+                    if (skipping) return 0;
+                    throw Executor::ExecutorException(
+                        "arithmetic: exponent less than 0");
+                }
+                uint64_t result = 1;
+                for (; ub; ub >>= 1, ua *= ua) {
+                    if (ub & 1) result *= ua;
+                }
+                return result;
+            }
+            return ua * ub;
+        case '/':
+        case '%':
+            if (b == 0) {
+                if (skipping) return 0;
+                throw Executor::ExecutorException("arithmetic: division by 0");
+            }
+            /* the one quotient that overflows */
+            if (b == -1) return op == "/" ? 0 - ua : 0;
+            return op == "/" ? a / b : a % b;
+        case '<':
+            if (op == "<<") return ua << (b & 63);
+            return op == "<=" ? a <= b : a < b;
+        case '>':
+            if (op == ">>") return a >> (b & 63);
+            return op == ">=" ? a >= b : a > b;
+        case '=': return a == b;
+        case '!': return a != b;
+        case '&': return op == "&&" ? a && b : a & b;
+        case '|': return op == "||" ? a || b : a | b;
+        case '^': return a ^ b;
+    }
+    return 0;
+}
+
+void Arithmetic::skip_blanks()
+{
+    while (_pos < _input.size() && std::isspace(byte(_input[_pos]))) ++_pos;
+}
+
+/** Consume 'op' if it comes next. */
+bool Arithmetic::accept(string_view op)
+{
+    skip_blanks();
+    if (_input.substr(_pos, op.size()) != op) return false;
+    _pos += op.size();
+    return true;
+}
+
+/** Consume a variable name if one comes next; returns "" otherwise. */
+string_view Arithmetic::parse_name()
+{
+    skip_blanks();
+    size_t start = _pos;
+    if (_pos < _input.size() &&
+        (std::isalpha(byte(_input[_pos])) || _input[_pos] == '_')) {
+        while (_pos < _input.size() &&
+               (std::isalnum(byte(_input[_pos])) || _input[_pos] == '_')) {
+            ++_pos;
+        }
+    }
+    return _input.substr(start, _pos - start);
+}
+
+void Arithmetic::syntax_error()
+{
+    throw Executor::ExecutorException("arithmetic: syntax error in '" +
+                                      string(_input) + "'");
+}
+
+int64_t Arithmetic::parse_comma()
+{
+    int64_t value = parse_assignment();
+    while (accept(",")) value = parse_assignment();
+    return value;
+}
+
+int64_t Arithmetic::parse_assignment()
+{
+    size_t start = _pos;
+    string_view name = parse_name();
+    if (!name.empty()) {
+        skip_blanks();
+        for (string_view op : kAssignmentOperators) {
+            if (_input.substr(_pos, op.size()) != op) continue;
+            if (op == "=" && _input.substr(_pos, 2) == "==") break;
+            _pos += op.size();
+            int64_t value = parse_assignment();
+            if (op != "=") {
+                value = apply(op.substr(0, op.size() - 1), value_of(name),
+                              value, _skipping);
+            }
+            assign(name, value);
+            return value;
+        }
+    }
+    _pos = start;
+    return parse_conditional();
+}
+
+int64_t Arithmetic::parse_conditional()
+{
+    int64_t condition = parse_binary(1);
+    if (!accept("?")) return condition;
+
+    if (!condition) ++_skipping;
+    int64_t if_true = parse_comma();
+    if (!condition) --_skipping;
+    if (!accept(":")) syntax_error();
+    if (condition) ++_skipping;
+    int64_t if_false = parse_conditional();
+    if (condition) --_skipping;
+    return condition ? if_true : if_false;
+}
+
+/**
+ * Parse a sequence of operands joined by binary operators of at least
+ * 'min_precedence' (precedence climbing). All are left-associative except
+ * '**'.
+ */
+int64_t Arithmetic::parse_binary(int min_precedence)
+{
+    int64_t left = parse_unary();
+    while (true) {
+        skip_blanks();
+        const BinaryOperator *op = nullptr;
+        for (const BinaryOperator &candidate : kBinaryOperators) {
+            if (_input.substr(_pos, candidate.text.size()) == candidate.text) {
+                op = &candidate;
+                break;
+            }
+        }
+        /* not an operator, or the first part of an assignment (e.g. '+=') */
+        if (!op || op->precedence < min_precedence ||
+            (_input.substr(_pos + op->text.size(), 1) == "=" &&
+             op->precedence != 6 && op->precedence != 7)) {
+            return left;
+        }
+        _pos += op->text.size();
+
+        /* short-circuit: the right operand isn't evaluated */
+        bool skip = (op->text == "&&" && !left) ||
+                    (op->text == "||" && left);
+        if (skip) ++_skipping;
+        int next = op->text == "**" ? op->precedence : op->precedence + 1;
+        int64_t right = parse_binary(next);
+        if (skip) --_skipping;
+        left = apply(op->text, left, right, _skipping);
+    }
+}
+
+int64_t Arithmetic::parse_unary()
+{
+    skip_blanks();
+    for (string_view op : {"++", "--"}) {
+        if (!accept(op)) continue;
+        string_view name = parse_name();
+        if (name.empty()) syntax_error();
+        int64_t value = apply(op.substr(0, 1), value_of(name), 1, _skipping);
+        assign(name, value);
+        return value;
+    }
+    if (accept("+")) return parse_unary();
+    if (accept("-")) return 0 - static_cast<uint64_t>(parse_unary());
+    if (accept("!")) return !parse_unary();
+    if (accept("~")) return ~parse_unary();
+    return parse_primary();
+}
+
+int64_t Arithmetic::parse_primary()
+{
+    skip_blanks();
+    if (_pos == _input.size()) syntax_error();
+
+    if (accept("(")) {
+        int64_t value = parse_comma();
+        if (!accept(")")) syntax_error();
+        return value;
+    }
+    if (std::isdigit(byte(_input[_pos]))) return parse_number();
+
+    string_view name;
+    if (accept("$")) {
+        /* $name, ${name}, or a special parameter like $# or $1 */
+        if (accept("{")) {
+            size_t close = _input.find('}', _pos);
+            if (close == string_view::npos) syntax_error();
+            name = _input.substr(_pos, close - _pos);
+            _pos = close + 1;
+        }
+        else if (_pos < _input.size() &&
+                 (_input[_pos] == '#' || _input[_pos] == '?' ||
+                  std::isdigit(byte(_input[_pos])))) {
+            name = _input.substr(_pos++, 1);
+        }
+        else {
+            name = parse_name();
+        }
+        if (name.empty()) syntax_error();
+        return value_of(name);
+    }
+
+    name = parse_name();
+    if (name.empty()) syntax_error();
+    /* postfix increment/decrement: the value is the one before */
+    for (string_view op : {"++", "--"}) {
+        if (!accept(op)) continue;
+        int64_t value = value_of(name);
+        assign(name, apply(op.substr(0, 1), value, 1, _skipping));
+        return value;
+    }
+    return value_of(name);
+}
+
+/**
+ * Parse a decimal, octal (0...), or hexadecimal (0x...) constant. Values too
+ * large for 64 bits wrap around.
+ */
+int64_t Arithmetic::parse_number()
+{
+    int base = 10;
+    if (_input[_pos] == '0') {
+        base = 8;
+        ++_pos;
+        if (_pos < _input.size() &&
+            (_input[_pos] == 'x' || _input[_pos] == 'X')) {
+            base = 16;
+            ++_pos;
+        }
+    }
+
+    uint64_t value = 0;
+    size_t start = _pos;
+    while (_pos < _input.size() && std::isalnum(byte(_input[_pos]))) {
+        char c = std::tolower(byte(_input[_pos]));
+        int digit = std::isdigit(c) ? c - '0' : c - 'a' + 10;
+        if (digit >= base) {
+            throw Executor::ExecutorException(
+                "arithmetic: value too great for base in '" +
+                string(_input) + "'");
+        }
+        value = value * base + digit;
+        ++_pos;
+    }
+    if (base == 16 && _pos == start) syntax_error();
+    return value;
+}
+
+/**
+ * Returns the value of a variable: 0 if it is unset or empty, and otherwise
+ * its value evaluated as an expression (usually just a number).
+ */
+int64_t Arithmetic::value_of(string_view name)
+{
+    if (_skipping) return 0;
+    if (_depth >= kMaxDepth) {
+        throw Executor::ExecutorException(
+            "arithmetic: expression recursion level exceeded");
+    }
+    return Arithmetic(_lookup(name), _lookup, _assign, _depth + 1).evaluate();
+}
+
+void Arithmetic::assign(string_view name, int64_t value)
+{
+    if (!_skipping) _assign(name, value);
+}
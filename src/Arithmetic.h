@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string_view>
+
+/**
+ * Evaluates the expression of an arithmetic expansion, $((...)), directly
+ * from its text: a precedence-climbing parser that computes values as it
+ * goes, over 64-bit signed integers (which wrap around on overflow).
+ *
+ * The operators are C's, with C's precedence: unary + - ! ~, the binary
+ * arithmetic, shift, comparison, bitwise, and logical operators, ?:, the
+ * assignment operators (=, +=, etc.), pre/post-increment and decrement, and
+ * the comma operator. Numbers may be decimal, octal (leading 0), or
+ * hexadecimal (leading 0x).
+ *
+ * Variables can be referenced by bare name or as $name / ${name}. Unset or
+ * empty variables count as 0, and a variable whose value is not a number is
+ * itself evaluated as an expression. The operands that && || and ?: skip are
+ * parsed but not evaluated, so they assign nothing and can't fail.
+ *
+ * Exceptions: evaluate() throws an Executor::ExecutorException for syntax
+ * errors and division by zero.
+ */
+class Arithmetic {
+  public:
+    /* returns the value of a variable ("" if it isn't set) */
+    using Lookup = std::function<std::string_view(std::string_view name)>;
+    /* assigns a variable */
+    using Assign = std::function<void(std::string_view name, int64_t value)>;
+
+    Arithmetic(std::string_view expression, const Lookup &lookup,
+               const Assign &assign, int depth = 0)
+      : _input(expression), _lookup(lookup), _assign(assign), _depth(depth) {}
+
+    int64_t evaluate();
+
+  private:
+    std::string_view _input;
+    const Lookup &_lookup;
+    const Assign &_assign;
+    /* nesting of variables evaluated as expressions */
+    int _depth;
+    size_t _pos = 0;
+    /* > 0 while parsing an operand that isn't evaluated */
+    int _skipping = 0;
+
+    void skip_blanks();
+    bool accept(std::string_view op);
+    std::string_view parse_name();
+    [[noreturn]] void syntax_error();
+
+    int64_t parse_comma();
+    int64_t parse_assignment();
+    int64_t parse_conditional();
+    int64_t parse_binary(int min_precedence);
+    int64_t parse_unary();
+    int64_t parse_primary();
+    int64_t parse_number();
+    int64_t value_of(std::string_view name);
+    void assign(std::string_view name, int64_t value);
+};
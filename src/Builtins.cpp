@@ -0,0 +1,1163 @@
+#include "Executor.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+/**
+ * Implementations of the commands that clash runs inside its own process.
+ *
+ * The special builtins (cd, exit, export, unset, set, hash, break, continue,
+ * return, jobs, wait) must run in the shell because they change (or report)
+ * its state. The utility builtins (echo, printf, true, false, test/[, sleep)
+ * only stand in for executables of the same name to save a fork and exec;
+ * 'set +o builtin_utils' turns them off so that the executables are used
+ * instead. 'parallel' is a regular builtin: it needs no shell state, but
+ * there is no executable of ours to fall back on, so it is always on.
+ *
+ * Each builtin writes its output to the command's output_fd, and returns its
+ * exit status.
+ */
+
+namespace fs = std::filesystem;
+using std::string;
+using std::string_view;
+
+const std::unordered_map<string_view, Executor::Builtin> Executor::kBuiltins {
+    {"cd",     {&Executor::builtin_cd,     Builtin::Kind::Special}},
+    {"exit",   {&Executor::builtin_exit,   Builtin::Kind::Special}},
+    {"export", {&Executor::builtin_export, Builtin::Kind::Special}},
+    {"unset",  {&Executor::builtin_unset,  Builtin::Kind::Special}},
+    {"set",    {&Executor::builtin_set,    Builtin::Kind::Special}},
+    {"hash",   {&Executor::builtin_hash,   Builtin::Kind::Special}},
+    {"break",  {&Executor::builtin_break,  Builtin::Kind::Special}},
+    {"continue", {&Executor::builtin_continue,
+                  Builtin::Kind::Special}},
+    {"return", {&Executor::builtin_return, Builtin::Kind::Special}},
+    {"jobs",   {&Executor::builtin_jobs,   Builtin::Kind::Special}},
+    {"wait",   {&Executor::builtin_wait,   Builtin::Kind::Special}},
+    {"echo",   {&Executor::builtin_echo,   Builtin::Kind::Utility}},
+    {"printf", {&Executor::builtin_printf, Builtin::Kind::Utility}},
+    {"true",   {&Executor::builtin_true,   Builtin::Kind::Utility}},
+    {"false",  {&Executor::builtin_false,  Builtin::Kind::Utility}},
+    {"test",   {&Executor::builtin_test,   Builtin::Kind::Utility}},
+    {"[",      {&Executor::builtin_test,   Builtin::Kind::Utility}},
+    {"sleep",  {&Executor::builtin_sleep,  Builtin::Kind::Utility}},
+    {"parallel", {&Executor::builtin_parallel,
+                  Builtin::Kind::Regular}},
+};
+
+/* boolean options which can be turned on/off with 'set -o/+o NAME' */
+static const struct {
+    const char *name;
+    bool Executor::Options::*flag;
+} kBooleanOptions[] = {
+    {"posix_spawn", &Executor::Options::posix_spawn},
+    {"execveat", &Executor::Options::execveat},
+    {"builtin_utils", &Executor::Options::builtin_utils},
+    {"parallel_substitutions", &Executor::Options::parallel_substitutions},
+    {"jobserver", &Executor::Options::jobserver},
+    {"pipefail", &Executor::Options::pipefail},
+};
+
+
+/**
+ * Write all of 'data' to a file descriptor, retrying after partial writes.
+ *
+ * @return 'false' if the write failed.
+ */
+static bool write_all(int fd, string_view data)
+{
+    while (!data.empty()) {
+        ssize_t n_written = write(fd, data.data(), data.size());
+        if (n_written == -1) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data.remove_prefix(n_written);
+    }
+    return true;
+}
+
+/** Report an error from a utility builtin on standard error. */
+static void print_error(const string &msg)
+{
+    std::cerr << "clash: " << msg << std::endl;
+}
+
+
+/* SPECIAL BUILTINS */
+
+int Executor::builtin_cd(Command &cmd)
+{
+    const Words &words = cmd.words;
+    // with no argument, go to $HOME
+    string dir(words.size() > 1 ? words[1] : lookup_variable("HOME"));
+    try {
+        fs::current_path(dir);
+    }
+    catch (...) {
+        string msg = "cd: " + dir + ": " + strerror(errno);
+        throw ExecutorException(msg);
+    }
+    return 0;
+}
+
+int Executor::builtin_exit(Command &cmd)
+{
+    const Words &words = cmd.words;
+    int status_code = 0;
+    if (words.size() > 1) {
+        try {
+            status_code = std::stoi(string(words[1]));
+        }
+        catch (...){
+            string msg = "exit: " + string(words[1]) +
+                         ": numeric argument required";
+            throw ExecutorException(msg);
+        }
+    }
+    save_path_cache();
+    _jobs.release_tokens();
+    exit(status_code);
+}
+
+/**
+ * 'export NAME...' adds variables to the environment of the executables
+ * launched from now on; 'export NAME=value' assigns the variable first.
+ */
+int Executor::builtin_export(Command &cmd)
+{
+    const Words &words = cmd.words;
+    for (size_t i = 1; i < words.size(); ++i) {
+        string_view name = words[i];
+        size_t eq_idx = name.find('=');
+        if (eq_idx != string_view::npos) {
+            name = name.substr(0, eq_idx);
+            _variables.set(name, words[i].substr(eq_idx + 1));
+        }
+        if (name.empty()) {
+            // bash behavior: do nothing for invalid variable
+            LOG_F(INFO, "export: invalid var: %s", words[i].data());
+            continue;
+        }
+        if (auto value = _variables.find(name)) _environment.set(name, *value);
+    }
+    return 0;
+}
+
+/**
+ * 'unset NAME...' unsets variables; 'unset -f NAME...' removes functions.
+ */
+int Executor::builtin_unset(Command &cmd)
+{
+    const Words &words = cmd.words;
+    if (words.size() > 1 && words[1] == "-f") {
+        for (size_t i = 2; i < words.size(); ++i) _functions.erase(words[i]);
+        return 0;
+    }
+    // delete each var (both in environment and variable store)
+    for (size_t i = 1; i < words.size(); ++i) {
+        _variables.unset(words[i]);
+        _environment.unset(words[i]);
+    }
+    return 0;
+}
+
+/**
+ * 'set -o NAME' turns a boolean option on, 'set +o NAME' turns it off, and
+ * 'set -o' alone lists every option with its state.
+ */
+int Executor::builtin_set(Command &cmd)
+{
+    const Words &words = cmd.words;
+    if (words.size() == 2 && words[1] == "-o") {
+        string listing;
+        for (const auto &option : kBooleanOptions) {
+            listing += string(option.name) + "\t" +
+                       (_options.*option.flag ? "on" : "off") + "\n";
+        }
+        write_all(cmd.output_fd, listing);
+        return 0;
+    }
+
+    for (size_t i = 1; i < words.size(); i += 2) {
+        if ((words[i] != "-o" && words[i] != "+o") || i + 1 == words.size()) {
+            throw ExecutorException("set: usage: set [-o|+o option]...");
+        }
+        auto option = std::find_if(std::begin(kBooleanOptions),
+                                   std::end(kBooleanOptions),
+                                   [&](const auto &opt) {
+                                       return words[i + 1] == opt.name;
+                                   });
+        if (option == std::end(kBooleanOptions)) {
+            throw ExecutorException("set: " + string(words[i + 1]) +
+                                    ": invalid option name");
+        }
+        _options.*option->flag = (words[i] == "-o");
+    }
+    return 0;
+}
+
+/**
+ * Inspects and manages the index of PATH directories (see PathIndex):
+ *   'hash'          lists the remembered commands with their number of hits
+ *   'hash NAME...'  looks up and remembers each NAME
+ *   'hash -w'       reads every PATH directory into the index now
+ *   'hash -r'       forgets everything remembered or read
+ */
+int Executor::builtin_hash(Command &cmd)
+{
+    const Words &words = cmd.words;
+    update_path_index();
+
+    if (words.size() == 1) {
+        std::vector<const PathIndex::Command*> commands;
+        for (const auto &entry : _path_index.commands()) {
+            commands.push_back(&entry.second);
+        }
+        if (commands.empty()) {
+            write_all(cmd.output_fd, "hash: hash table empty\n");
+            return 0;
+        }
+        std::sort(commands.begin(), commands.end(), 
+                  [](const auto *a, const auto *b) { 
+                      return a->path < b->path; 
+                  });
+        string listing = "hits\tcommand\n";
+        for (const PathIndex::Command *command : commands) {
+            char hits[32];
+            snprintf(hits, sizeof(hits), "%4zu\t", command->hits);
+            listing += hits + command->path + "\n";
+        }
+        write_all(cmd.output_fd, listing);
+        return 0;
+    }
+
+    for (size_t i = 1; i < words.size(); ++i) {
+        if (words[i] == "-r") {
+            _path_index.clear();
+        }
+        else if (words[i] == "-w") {
+            _path_index.hash_all();
+        }
+        else if (words[i].find('/') == string_view::npos) {
+            if (!find_executable(words[i])) {
+                throw ExecutorException("hash: " + string(words[i]) + 
+                                        ": not found");
+            }
+        }
+    }
+    return 0;
+}
+
+int Executor::builtin_break(Command &cmd)
+{
+    return loop_control(cmd, Control::Break);
+}
+
+int Executor::builtin_continue(Command &cmd)
+{
+    return loop_control(cmd, Control::Continue);
+}
+
+/**
+ * 'break [N]' and 'continue [N]' end the current iteration of the N-th 
+ * enclosing loop (default 1, or the outermost if there are fewer), and 
+ * 'break' the loop itself. Outside of loops they do nothing.
+ */
+int Executor::loop_control(Command &cmd, Control control)
+{
+    const Words &words = cmd.words;
+    int levels = 1;
+    if (words.size() > 1) {
+        string msg = string(words[0]) + ": " + string(words[1]);
+        try {
+            levels = std::stoi(string(words[1]));
+        }
+        catch (...) {
+            throw ExecutorException(msg + ": numeric argument required");
+        }
+        if (levels < 1) {
+            throw ExecutorException(msg + ": loop count out of range");
+        }
+    }
+    if (_loop_depth == 0) return 0;
+    _control = control;
+    _control_levels = std::min(levels, _loop_depth);
+    return 0;
+}
+
+/**
+ * 'return [N]' ends the function being executed, with status N, or that of 
+ * the last command executed.
+ */
+int Executor::builtin_return(Command &cmd)
+{
+    const Words &words = cmd.words;
+    if (_function_depth == 0) {
+        throw ExecutorException("return: can only return from a function");
+    }
+    int status = _variables.status();
+    if (words.size() > 1) {
+        try {
+            status = std::stoi(string(words[1]));
+        }
+        catch (...) {
+            throw ExecutorException("return: " + string(words[1]) +
+                                    ": numeric argument required");
+        }
+    }
+    _control = Control::Return;
+    return status & 255;
+}
+
+/**
+ * 'jobs' lists the background jobs with their states. Finished jobs are
+ * listed once, and forgotten the next time (unless waited for before).
+ */
+int Executor::builtin_jobs(Command &cmd)
+{
+    _jobs.reap();
+    _jobs.remove_reported();
+    string listing;
+    for (const JobTable::Job &job : _jobs.jobs()) {
+        string state = job.n_running > 0 ? "Running" 
+                     : job.status == 0 ? "Done" 
+                     : "Exit " + std::to_string(job.status);
+        state.resize(std::max<size_t>(state.size() + 1, 24), ' ');
+        listing += "[" + std::to_string(job.id) + "]  " + state + job.text +
+                   " &\n";
+    }
+    write_all(cmd.output_fd, listing);
+    _jobs.mark_reported();
+    return 0;
+}
+
+/**
+ * 'wait' waits for every background job to finish. 'wait ID...' waits for
+ * the jobs given by number (%N) or by the pid of one of their processes, and
+ * returns the status of the last one (127 if there is no such job).
+ */
+int Executor::builtin_wait(Command &cmd)
+{
+    const Words &words = cmd.words;
+    if (words.size() == 1) {
+        while (!_jobs.empty()) _jobs.wait(_jobs.jobs().front().id);
+        return 0;
+    }
+
+    int status = 0;
+    for (size_t i = 1; i < words.size(); ++i) {
+        string arg(words[i]);
+        const JobTable::Job *job = nullptr;
+        try {
+            job = arg[0] == '%' ? _jobs.find(std::stoi(arg.substr(1)))
+                                : _jobs.find_pid(std::stoi(arg));
+        }
+        catch (...) {
+            throw ExecutorException("wait: " + arg + 
+                                    ": not a pid or valid job spec");
+        }
+        if (!job) {
+            print_error("wait: " + arg + ": no such job");
+            status = 127;
+            continue;
+        }
+        status = _jobs.wait(job->id);
+    }
+    return status;
+}
+
+
+/* UTILITY BUILTINS */
+
+/**
+ * Append the character for the backslash escape sequence starting at
+ * 'str[i]' (just past the backslash) to 'out', as understood by 'echo -e'
+ * and 'printf'. Octal escapes are '\0NNN' for echo and '\NNN' for printf.
+ *
+ * @return The number of characters of 'str' consumed after the backslash,
+ *         or -1 for '\c' (which ends all output).
+ */
+static int append_escape(string_view str, size_t i, bool echo_octal,
+                         string &out)
+{
+    if (i >= str.size()) {
+        out += '\\';
+        return 0;
+    }
+    switch (str[i]) {
+        case 'a': out += '\a'; return 1;
+        case 'b': out += '\b'; return 1;
+        case 'c': return -1;
+        case 'e': out += '\x1b'; return 1;
+        case 'f': out += '\f'; return 1;
+        case 'n': out += '\n'; return 1;
+        case 'r': out += '\r'; return 1;
+        case 't': out += '\t'; return 1;
+        case 'v': out += '\v'; return 1;
+        case '\\': out += '\\'; return 1;
+    }
+
+    /* octal escapes */
+    size_t start = i;
+    if (echo_octal) {
+        if (str[i] != '0') {
+            out += '\\';
+            return 0;
+        }
+        ++start;
+    }
+    else if (str[i] < '0' || str[i] > '7') {
+        out += '\\';
+        return 0;
+    }
+    int value = 0;
+    size_t end = start;
+    while (end < str.size() && end - start < 3 &&
+           str[end] >= '0' && str[end] <= '7') {
+        value = value * 8 + (str[end++] - '0');
+    }
+    out += static_cast<char>(value);
+    return end - i;
+}
+
+/**
+ * Prints its arguments separated by spaces. '-n' suppresses the trailing
+ * newline; '-e' enables backslash escapes and '-E' disables them.
+ */
+int Executor::builtin_echo(Command &cmd)
+{
+    const Words &words = cmd.words;
+    bool newline = true, escapes = false;
+    size_t i = 1;
+    for (; i < words.size(); ++i) {
+        string_view arg = words[i];
+        if (arg.size() < 2 || arg[0] != '-' ||
+            arg.find_first_not_of("neE", 1) != string_view::npos) break;
+        for (char flag : arg.substr(1)) {
+            if (flag == 'n') newline = false;
+            else escapes = (flag == 'e');
+        }
+    }
+
+    string out;
+    for (size_t first = i; i < words.size(); ++i) {
+        if (i > first) out += ' ';
+        if (!escapes) {
+            out += words[i];
+            continue;
+        }
+        string_view arg = words[i];
+        for (size_t j = 0; j < arg.size(); ++j) {
+            if (arg[j] != '\\') {
+                out += arg[j];
+                continue;
+            }
+            int consumed = append_escape(arg, j + 1, true, out);
+            if (consumed == -1) {
+                return write_all(cmd.output_fd, out) ? 0 : 1;
+            }
+            j += consumed;
+        }
+    }
+    if (newline) out += '\n';
+
+    if (!write_all(cmd.output_fd, out)) {
+        print_error(string("echo: write error: ") + strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Parse a printf numeric argument: an integer in C notation, or a quote
+ * followed by a character (whose value is used).
+ */
+static bool parse_printf_number(string_view arg, long long &value)
+{
+    if (arg.empty()) {
+        value = 0;
+        return true;
+    }
+    if (arg[0] == '\'' || arg[0] == '"') {
+        value = arg.size() > 1 ? static_cast<unsigned char>(arg[1]) : 0;
+        return true;
+    }
+    string str(arg);
+    char *end;
+    errno = 0;
+    value = std::strtoll(str.c_str(), &end, 0);
+    return errno == 0 && *end == '\0';
+}
+
+/**
+ * Formats its arguments according to a format string, as printf(1) does:
+ * %s %b %c %d %i %o %u %x %X %e %f %g %E %G %%, with flags, width, and
+ * precision. The format is reused until all arguments are consumed.
+ */
+int Executor::builtin_printf(Command &cmd)
+{
+    const Words &words = cmd.words;
+    if (words.size() < 2) {
+        print_error("printf: usage: printf format [arguments]");
+        return 2;
+    }
+    string_view format = words[1];
+    size_t next_arg = 2;
+    int status = 0;
+    string out;
+
+    auto take_arg = [&]() -> string_view {
+        return next_arg < words.size() ? words[next_arg++] : string_view();
+    };
+
+    do {
+        size_t args_before = next_arg;
+        for (size_t i = 0; i < format.size(); ++i) {
+            if (format[i] == '\\') {
+                int consumed = append_escape(format, i + 1, false, out);
+                if (consumed == -1) goto done;
+                i += consumed;
+                continue;
+            }
+            if (format[i] != '%') {
+                out += format[i];
+                continue;
+            }
+            if (i + 1 < format.size() && format[i + 1] == '%') {
+                out += '%';
+                ++i;
+                continue;
+            }
+
+            /* CONVERSION SPECIFICATION: %[flags][width][.precision]conv */
+            string spec = "%";
+            size_t j = i + 1;
+            while (j < format.size() && strchr("-+ #0", format[j])) {
+                spec += format[j++];
+            }
+            for (int part = 0; part < 2; ++part) {
+                if (part == 1) {
+                    if (j >= format.size() || format[j] != '.') break;
+                    spec += format[j++];
+                }
+                if (j < format.size() && format[j] == '*') {
+                    long long n;
+                    if (!parse_printf_number(take_arg(), n)) n = 0;
+                    spec += std::to_string(n);
+                    ++j;
+                }
+                while (j < format.size() &&
+                       std::isdigit(static_cast<unsigned char>(format[j]))) {
+                    spec += format[j++];
+                }
+            }
+            if (j >= format.size()) {
+                print_error("printf: " + string(format.substr(i)) +
+                            ": invalid conversion");
+                return 1;
+            }
+            char conv = format[j];
+            i = j;
+
+            char buf[512];
+            string_view arg;
+            switch (conv) {
+                case 's':
+                case 'b': {
+                    arg = take_arg();
+                    string str;
+                    if (conv == 'b') {
+                        for (size_t k = 0; k < arg.size(); ++k) {
+                            if (arg[k] != '\\') {
+                                str += arg[k];
+                                continue;
+                            }
+                            int consumed = append_escape(arg, k + 1, true, str);
+                            if (consumed == -1) goto done;
+                            k += consumed;
+                        }
+                    }
+                    else str = arg;
+                    spec += 's';
+                    int len = snprintf(nullptr, 0, spec.c_str(), str.c_str());
+                    string formatted(len, '\0');
+                    snprintf(&formatted[0], len + 1, spec.c_str(), str.c_str());
+                    out += formatted;
+                    continue;
+                }
+                case 'c':
+                    arg = take_arg();
+                    spec += 'c';
+                    snprintf(buf, sizeof(buf), spec.c_str(),
+                             arg.empty() ? '\0' : arg[0]);
+                    out += buf;
+                    continue;
+                case 'd':
+                case 'i':
+                case 'o':
+                case 'u':
+                case 'x':
+                case 'X': {
+                    arg = take_arg();
+                    long long value;
+                    if (!parse_printf_number(arg, value)) {
+                        print_error("printf: " + string(arg) +
+                                    ": invalid number");
+                        status = 1;
+                    }
+                    spec += "ll";
+                    spec += conv;
+                    snprintf(buf, sizeof(buf), spec.c_str(), value);
+                    out += buf;
+                    continue;
+                }
+                case 'e':
+                case 'E':
+                case 'f':
+                case 'F':
+                case 'g':
+                case 'G': {
+                    arg = take_arg();
+                    string str(arg);
+                    char *end;
+                    double value = str.empty() ? 0 : strtod(str.c_str(), &end);
+                    if (!str.empty() && *end != '\0') {
+                        print_error("printf: " + str + ": invalid number");
+                        status = 1;
+                    }
+                    spec += conv;
+                    snprintf(buf, sizeof(buf), spec.c_str(), value);
+                    out += buf;
+                    continue;
+                }
+                default:
+                    print_error(string("printf: %") + conv +
+                                ": invalid directive");
+                    return 1;
+            }
+        }
+        /* reuse the format only while it keeps consuming arguments */
+        if (next_arg == args_before) break;
+    } while (next_arg < words.size());
+
+done:
+    if (!write_all(cmd.output_fd, out)) {
+        print_error(string("printf: write error: ") + strerror(errno));
+        return 1;
+    }
+    return status;
+}
+
+int Executor::builtin_true(Command &)
+{
+    return 0;
+}
+
+int Executor::builtin_false(Command &)
+{
+    return 1;
+}
+
+/**
+ * Evaluates the expression given as arguments to 'test' (or '[ ... ]'), by
+ * recursive descent over:
+ *
+ *   expr    := and ( '-o' and )*
+ *   and     := not ( '-a' not )*
+ *   not     := '!' not | primary
+ *   primary := '(' expr ')' | arg BINARY_OP arg | UNARY_OP arg | arg
+ */
+class TestExpression {
+  public:
+    TestExpression(const string_view *args, size_t n_args)
+      : _args(args), _n_args(n_args) {}
+
+    /** @return 0 if the expression is true, 1 if false, 2 on error */
+    int evaluate() {
+        if (_n_args == 0) return 1;
+        bool result = parse_or();
+        if (!_error.empty()) {
+            print_error("test: " + _error);
+            return 2;
+        }
+        if (_pos < _n_args) {
+            print_error("test: " + string(_args[_pos]) +
+                        ": unexpected argument");
+            return 2;
+        }
+        return result ? 0 : 1;
+    }
+
+  private:
+    const string_view *_args;
+    size_t _n_args;
+    size_t _pos = 0;
+    string _error;
+
+    bool at(string_view token) const {
+        return _pos < _n_args && _args[_pos] == token;
+    }
+
+    bool parse_or() {
+        bool result = parse_and();
+        while (_error.empty() && at("-o")) {
+            ++_pos;
+            bool rhs = parse_and();
+            result = result || rhs;
+        }
+        return result;
+    }
+
+    bool parse_and() {
+        bool result = parse_not();
+        while (_error.empty() && at("-a")) {
+            ++_pos;
+            bool rhs = parse_not();
+            result = result && rhs;
+        }
+        return result;
+    }
+
+    bool parse_not() {
+        if (at("!") && _pos + 1 < _n_args) {
+            ++_pos;
+            return !parse_not();
+        }
+        return parse_primary();
+    }
+
+    bool parse_primary() {
+        if (_pos >= _n_args) {
+            _error = "argument expected";
+            return false;
+        }
+        if (at("(") && _pos + 1 < _n_args) {
+            ++_pos;
+            bool result = parse_or();
+            if (!at(")")) {
+                if (_error.empty()) _error = "')' expected";
+                return false;
+            }
+            ++_pos;
+            return result;
+        }
+        if (_pos + 2 < _n_args && is_binary_op(_args[_pos + 1])) {
+            string_view lhs = _args[_pos], op = _args[_pos + 1],
+                        rhs = _args[_pos + 2];
+            _pos += 3;
+            return binary(lhs, op, rhs);
+        }
+        if (_pos + 1 < _n_args && is_unary_op(_args[_pos])) {
+            string_view op = _args[_pos], operand = _args[_pos + 1];
+            _pos += 2;
+            return unary(op, operand);
+        }
+        return !_args[_pos++].empty();
+    }
+
+    static bool is_unary_op(string_view op) {
+        return op.size() == 2 && op[0] == '-' &&
+               strchr("bcdefghLnprsSwxz", op[1]);
+    }
+
+    static bool is_binary_op(string_view op) {
+        static const string_view kOps[] = {
+            "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt",
+            "-ge", "-nt", "-ot", "-ef"
+        };
+        return std::find(std::begin(kOps), std::end(kOps), op) !=
+               std::end(kOps);
+    }
+
+    bool unary(string_view op, string_view operand) {
+        string path(operand);
+        struct stat st;
+        switch (op[1]) {
+            case 'n': return !operand.empty();
+            case 'z': return operand.empty();
+            case 'r': return access(path.c_str(), R_OK) == 0;
+            case 'w': return access(path.c_str(), W_OK) == 0;
+            case 'x': return access(path.c_str(), X_OK) == 0;
+            case 'h':
+            case 'L':
+                return lstat(path.c_str(), &st) == 0 && S_ISLNK(st.st_mode);
+        }
+        if (stat(path.c_str(), &st) != 0) return false;
+        switch (op[1]) {
+            case 'b': return S_ISBLK(st.st_mode);
+            case 'c': return S_ISCHR(st.st_mode);
+            case 'd': return S_ISDIR(st.st_mode);
+            case 'f': return S_ISREG(st.st_mode);
+            case 'g': return st.st_mode & S_ISGID;
+            case 'p': return S_ISFIFO(st.st_mode);
+            case 's': return st.st_size > 0;
+            case 'S': return S_ISSOCK(st.st_mode);
+            default: return true; // -e
+        }
+    }
+
+    bool integer(string_view arg, long long &value) {
+        string str(arg);
+        char *end;
+        errno = 0;
+        value = std::strtoll(str.c_str(), &end, 10);
+        if (str.empty() || *end != '\0' || errno != 0) {
+            _error = str + ": integer expression expected";
+            return false;
+        }
+        return true;
+    }
+
+    bool binary(string_view lhs, string_view op, string_view rhs) {
+        if (op == "=" || op == "==") return lhs == rhs;
+        if (op == "!=") return lhs != rhs;
+        if (op == "<") return lhs < rhs;
+        if (op == ">") return lhs > rhs;
+
+        if (op == "-nt" || op == "-ot" || op == "-ef") {
+            struct stat l, r;
+            bool l_ok = stat(string(lhs).c_str(), &l) == 0;
+            bool r_ok = stat(string(rhs).c_str(), &r) == 0;
+            if (op == "-ef") {
+                return l_ok && r_ok && l.st_dev == r.st_dev &&
+                       l.st_ino == r.st_ino;
+            }
+            if (op == "-nt") return l_ok && (!r_ok || l.st_mtime > r.st_mtime);
+            return r_ok && (!l_ok || l.st_mtime < r.st_mtime);
+        }
+
+        long long l, r;
+        if (!integer(lhs, l) || !integer(rhs, r)) return false;
+        if (op == "-eq") return l == r;
+        if (op == "-ne") return l != r;
+        if (op == "-lt") return l < r;
+        if (op == "-le") return l <= r;
+        if (op == "-gt") return l > r;
+        return l >= r; // -ge
+    }
+};
+
+/**
+ * Evaluates a conditional expression (see TestExpression). When invoked as
+ * '[', the last argument must be ']'.
+ */
+int Executor::builtin_test(Command &cmd)
+{
+    const Words &words = cmd.words;
+    size_t n_args = words.size() - 1;
+    if (words[0] == "[") {
+        if (words.back() != "]") {
+            print_error("[: missing ']'");
+            return 2;
+        }
+        --n_args;
+    }
+    return TestExpression(words.data() + 1, n_args).evaluate();
+}
+
+/**
+ * Pauses for the sum of its arguments, each a (possibly fractional) number
+ * with an optional unit suffix: s (default), m, h, or d.
+ */
+int Executor::builtin_sleep(Command &cmd)
+{
+    const Words &words = cmd.words;
+    if (words.size() < 2) {
+        print_error("sleep: missing operand");
+        return 1;
+    }
+
+    double seconds = 0;
+    for (size_t i = 1; i < words.size(); ++i) {
+        string arg(words[i]);
+        char *end;
+        double value = strtod(arg.c_str(), &end);
+        double multiplier = 1;
+        if (*end != '\0' && end[1] == '\0') {
+            switch (*end) {
+                case 's': multiplier = 1; ++end; break;
+                case 'm': multiplier = 60; ++end; break;
+                case 'h': multiplier = 60 * 60; ++end; break;
+                case 'd': multiplier = 24 * 60 * 60; ++end; break;
+            }
+        }
+        if (arg.empty() || *end != '\0' || value < 0 || std::isnan(value)) {
+            print_error("sleep: invalid time interval '" + arg + "'");
+            return 1;
+        }
+        seconds += value * multiplier;
+    }
+
+    struct timespec remaining;
+    remaining.tv_sec = static_cast<time_t>(seconds);
+    remaining.tv_nsec = static_cast<long>((seconds - remaining.tv_sec) * 1e9);
+    while (nanosleep(&remaining, &remaining) == -1 && errno == EINTR) {}
+    return 0;
+}
+
+/* a command started by 'parallel' */
+struct ParallelTask {
+    pid_t pid = -1;
+    /* -1 if there is none: then the process is polled */
+    int pidfd = -1;
+    /* with -k: the pipe from its output, until end of file */
+    int output_fd = -1;
+    std::string output;
+    int status = 0;
+    bool exited = false;
+};
+
+/**
+ * Runs a command once for each of a list of arguments, up to N at a time
+ * (-j N; by default the job limit of '&', see Options::max_jobs):
+ *
+ *     parallel [-j N] [-k] command [arg...] ::: argument...
+ *     parallel [-j N] [-k] command [arg...] < arguments
+ *
+ * Without ':::', the arguments are the lines of standard input. Each '{}' in
+ * the command is replaced by the argument; without any, the argument is
+ * added at the end. The commands are executables, launched like any other
+ * (no forked shell in between), with input from /dev/null.
+ *
+ * Output goes straight to this command's output as it is written, so the
+ * outputs of different commands may be interleaved. With -k, each command
+ * writes into a pipe instead, and outputs are merged in the order of the
+ * arguments: that of the earliest unfinished command as it arrives, those of
+ * later ones once all before them are done.
+ *
+ * The exit status is the number of commands that failed (at most 125).
+ */
+int Executor::builtin_parallel(Command &cmd)
+{
+    static const char *kUsage = "parallel: usage: parallel [-j N] [-k] "
+                                "command [arg...] [::: argument...]";
+    const Words &words = cmd.words;
+    size_t n_workers = job_limit();
+    bool keep_order = false;
+    size_t i = 1;
+    for (; i < words.size() && !words[i].empty() && words[i][0] == '-';
+         ++i) {
+        if (words[i] == "-k") {
+            keep_order = true;
+        } else if (words[i] == "-j" && i + 1 < words.size()) {
+            string arg(words[++i]);
+            char *end;
+            long n = strtol(arg.c_str(), &end, 10);
+            if (*end || n < 1) {
+                print_error("parallel: -j: invalid number '" + arg + "'");
+                return 2;
+            }
+            n_workers = n;
+        } else if (words[i] == "--") {
+            ++i;
+            break;
+        } else {
+            print_error(kUsage);
+            return 2;
+        }
+    }
+    auto separator = std::find(words.begin() + i, words.end(), ":::");
+    std::vector<string_view> pattern(words.begin() + i, separator);
+    if (pattern.empty()) {
+        print_error(kUsage);
+        return 2;
+    }
+
+    std::vector<string> arguments;
+    if (separator != words.end()) {
+        arguments.assign(separator + 1, words.end());
+    } else {
+        string input;
+        char buffer[4096];
+        ssize_t n_read;
+        while ((n_read = read(cmd.input_fd, buffer, sizeof(buffer))) != 0) {
+            if (n_read == -1) {
+                if (errno == EINTR) continue;
+                print_error(string("parallel: ") + strerror(errno));
+                return 1;
+            }
+            input.append(buffer, n_read);
+        }
+        for (size_t start = 0; start < input.size();) {
+            size_t end = std::min(input.find('\n', start), input.size());
+            arguments.emplace_back(input, start, end - start);
+            start = end + 1;
+        }
+    }
+
+    // start the command for one argument; 'false' if it couldn't be
+    auto start = [&](ParallelTask &task, const string &argument) {
+        std::vector<string> command_words;
+        bool substituted = false;
+        for (string_view word : pattern) {
+            string expanded;
+            for (size_t pos = 0; pos < word.size();) {
+                size_t brace = word.find("{}", pos);
+                expanded += word.substr(pos, brace - pos);
+                if (brace == string_view::npos) break;
+                expanded += argument;
+                substituted = true;
+                pos = brace + 2;
+            }
+            command_words.push_back(std::move(expanded));
+        }
+        if (!substituted) command_words.push_back(argument);
+
+        const string &name = command_words[0];
+        const char *path = name.find('/') != string::npos
+            ? name.c_str() : find_executable(name);
+        if (!path) {
+            print_error("parallel: command not found: " + name);
+            return false;
+        }
+        std::vector<char *> argv;
+        argv.push_back(const_cast<char *>(path));
+        for (size_t k = 1; k < command_words.size(); ++k) {
+            argv.push_back(command_words[k].data());
+        }
+        argv.push_back(nullptr);
+
+        Command task_cmd(_arena, cmd.output_fd);
+        task_cmd.input_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (task_cmd.input_fd == -1) task_cmd.input_fd = STDIN_FILENO;
+        if (keep_order) {
+            int fds[2];
+            if (pipe(fds) == -1) {
+                print_error(string("parallel: ") + strerror(errno));
+                return false;
+            }
+            fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+            fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+            task.output_fd = fds[0];
+            task_cmd.output_fd = fds[1];
+        }
+        try {
+            task.pid = launch_executable(task_cmd, argv.data());
+        }
+        catch (ExecutorException &e) {
+            print_error(string("parallel: ") + e.what());
+            if (task.output_fd != -1) close(task.output_fd);
+            task.output_fd = -1;
+            return false;
+        }
+#if defined(__linux__) && defined(SYS_pidfd_open)
+        task.pidfd = syscall(SYS_pidfd_open, task.pid, 0);
+#endif
+        return true;
+    };
+    auto finish = [&](ParallelTask &task, int wait_status) {
+        task.status = JobTable::exit_status(wait_status);
+        task.exited = true;
+        if (task.pidfd != -1) close(task.pidfd);
+        task.pidfd = -1;
+    };
+
+    std::vector<ParallelTask> tasks(arguments.size());
+    size_t n_started = 0;
+    size_t n_running = 0;
+    size_t n_failed = 0;
+    // the tasks before this one are done, and their output written out
+    size_t head = 0;
+    std::vector<struct pollfd> fds;
+    std::vector<size_t> owners;
+    while (true) {
+        while (n_started < tasks.size() && n_running < n_workers) {
+            ParallelTask &task = tasks[n_started];
+            if (start(task, arguments[n_started])) {
+                ++n_running;
+            } else {
+                task.status = 127;
+                task.exited = true;
+            }
+            ++n_started;
+        }
+        while (head < n_started) {
+            ParallelTask &task = tasks[head];
+            write_all(cmd.output_fd, task.output);
+            task.output.clear();
+            if (!task.exited || task.output_fd != -1) break;
+            if (task.status != 0) ++n_failed;
+            ++head;
+        }
+        if (head == tasks.size()) break;
+
+        fds.clear();
+        owners.clear();
+        bool polled = false;
+        for (size_t k = head; k < n_started; ++k) {
+            ParallelTask &task = tasks[k];
+            if (task.output_fd != -1) {
+                fds.push_back({task.output_fd, POLLIN, 0});
+                owners.push_back(k);
+            }
+            if (!task.exited && task.pidfd != -1) {
+                fds.push_back({task.pidfd, POLLIN, 0});
+                owners.push_back(k);
+            }
+            polled = polled || (!task.exited && task.pidfd == -1);
+        }
+        if (poll(fds.data(), fds.size(), polled ? 10 : -1) == -1 &&
+            errno != EINTR) {
+            // give up on the commands still running, leaving nothing behind
+            print_error(string("parallel: poll: ") + strerror(errno));
+            for (size_t k = head; k < n_started; ++k) {
+                ParallelTask &task = tasks[k];
+                if (task.output_fd != -1) close(task.output_fd);
+                task.output_fd = -1;
+                if (task.exited) continue;
+                kill(task.pid, SIGTERM);
+                int wait_status = 0;
+                while (waitpid(task.pid, &wait_status, 0) == -1 &&
+                       errno == EINTR) {}
+                finish(task, wait_status);
+            }
+            return 1;
+        }
+        for (size_t k = 0; k < fds.size(); ++k) {
+            if (!fds[k].revents) continue;
+            ParallelTask &task = tasks[owners[k]];
+            if (fds[k].fd == task.output_fd) {
+                char buffer[4096];
+                ssize_t n_read = read(task.output_fd, buffer, sizeof(buffer));
+                if (n_read > 0) {
+                    task.output.append(buffer, n_read);
+                } else if (n_read == 0 || errno != EINTR) {
+                    close(task.output_fd);
+                    task.output_fd = -1;
+                }
+                continue;
+            }
+            int wait_status = 0;
+            if (waitpid(task.pid, &wait_status, WNOHANG) == task.pid) {
+                finish(task, wait_status);
+                --n_running;
+            }
+        }
+        if (polled) {
+            for (size_t k = head; k < n_started; ++k) {
+                ParallelTask &task = tasks[k];
+                int wait_status = 0;
+                if (!task.exited && task.pidfd == -1 &&
+                    waitpid(task.pid, &wait_status, WNOHANG) == task.pid) {
+                    finish(task, wait_status);
+                    --n_running;
+                }
+            }
+        }
+    }
+    return std::min<size_t>(n_failed, 125);
+}
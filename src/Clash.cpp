@@ -1,28 +1,62 @@
 #include "Clash.h"
+#include <algorithm>
 #include <stdexcept>
 #include <iostream>
 #include <fstream>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
 
 #include "Executor.h"
 
+/*
+ * Execute a complete command in the shell, reporting any error.
+ *
+ * @return 'false' if the command failed with an error.
+ */
+static bool execute(Executor& executor, const std::string& input) {
+    try {
+        executor.execute_command(input);
+        return true;
+    }
+    catch (Executor::ExecutorException& e) {
+        std::cerr << "clash: " << e.what() << std::endl;
+    }
+    catch (std::exception& e) {
+        std::cerr << "clash: " << e.what() << std::endl;
+        LOG_F(INFO, "uncaught exception: %s", e.what());
+    }
+    return false;
+}
+
 /*
  * Continually reads lines and evaluates them as commands until a stop 
- * condition is reached. 
+ * condition is reached. A command that continues onto further lines (e.g. a
+ * 'for' loop) is read in full before any of it is executed.
  * 
  * @param file An open file from which to read
  * @param is_terminal 'true' if the file is a terminal, false otherwise. 
  */
 void repl(std::istream& file, bool is_terminal, Executor& executor) {
+    // the lines of an incomplete command read so far
+    std::string input;
     while (true) {
         if (is_terminal) {
-            std::cout << "% ";
+            std::cout << (input.empty() ? "% " : "> ");
         }
         std::string line;
         if (!getline(file, line)) {
             break;;
         }
+        input += line;
         try {
-            executor.execute_command(line);
+            executor.execute_command(input);
+        }
+        catch (Executor::IncompleteInputException& e) {
+            input += '\n';
+            continue;
         }
         catch (Executor::ExecutorException& e) {
             std::cerr << "clash: " << e.what() << std::endl;
@@ -31,9 +65,13 @@ void repl(std::istream& file, bool is_terminal, Executor& executor) {
             std::cerr << "clash: " << e.what() << std::endl;
             LOG_F(INFO, "uncaught exception: %s", e.what());
         }
+        input.clear();
     }
 
     // determine why we broke from loop
+    if (!input.empty()) {
+        std::cerr << "clash: syntax error: unexpected end of file" << std::endl;
+    }
     if (file.bad()) {
         std::cerr << "clash: bad file: " << strerror(errno) << std::endl;
     }
@@ -42,12 +80,279 @@ void repl(std::istream& file, bool is_terminal, Executor& executor) {
     }
 }
 
+/* a command of a '-j' script, and its progress */
+struct ScriptJob {
+    std::string text;
+    /* where it starts in the script */
+    size_t line_number;
+    pid_t pid = -1;
+    /* pipes from its standard output and error; -1 once at end of file */
+    int fds[2] = {-1, -1};
+    /* output not yet written out */
+    std::string buffers[2];
+    int status = 0;
+    bool done = false;
+};
+
+/*
+ * Fork a worker that executes a job's command, with its output going into
+ * two pipes.
+ */
+static void start(ScriptJob& job, Executor& executor) {
+    int out[2], err[2];
+    if (pipe(out) == -1) {
+        throw std::runtime_error(std::string("pipe: ") + strerror(errno));
+    }
+    if (pipe(err) == -1) {
+        close(out[0]);
+        close(out[1]);
+        throw std::runtime_error(std::string("pipe: ") + strerror(errno));
+    }
+    for (int fd : {out[0], out[1], err[0], err[1]}) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    std::cout.flush();
+    job.pid = fork();
+    if (job.pid == 0) {
+        dup2(out[1], STDOUT_FILENO);
+        dup2(err[1], STDERR_FILENO);
+        bool ok = execute(executor, job.text);
+        std::cout.flush();
+        _exit(ok ? executor.status() : 1);
+    }
+    close(out[1]);
+    close(err[1]);
+    if (job.pid == -1) {
+        close(out[0]);
+        close(err[0]);
+        throw std::runtime_error(std::string("fork: ") + strerror(errno));
+    }
+    job.fds[0] = out[0];
+    job.fds[1] = err[0];
+}
+
+/* Write out a job's buffered output. */
+static void flush(ScriptJob& job) {
+    for (int i = 0; i < 2; ++i) {
+        std::string_view data = job.buffers[i];
+        while (!data.empty()) {
+            ssize_t n_written = write(STDOUT_FILENO + i, data.data(),
+                                      data.size());
+            if (n_written == -1 && errno == EINTR) continue;
+            if (n_written <= 0) break;
+            data.remove_prefix(n_written);
+        }
+        job.buffers[i].clear();
+    }
+}
+
+/* Wait for a job whose output has reached end of file (or been abandoned). */
+static void reap(ScriptJob& job) {
+    for (int& fd : job.fds) {
+        if (fd != -1) close(fd);
+        fd = -1;
+    }
+    int wait_status = 0;
+    while (waitpid(job.pid, &wait_status, 0) == -1 && errno == EINTR) {}
+    job.status = JobTable::exit_status(wait_status);
+    job.done = true;
+}
+
+/*
+ * Execute independent commands with up to 'n_workers' of them running at
+ * once, each in a forked worker. Output is passed on in the order of the
+ * commands: that of the earliest unfinished command as it arrives, that of
+ * the others once all before them have finished.
+ *
+ * If a worker can't be started (or poll() fails), the error is reported and
+ * no more commands are started; those already running are finished (or, 
+ * without poll(), reaped with their unread output lost), and the commands
+ * not run (or cut short) count as failed.
+ *
+ * @return The number of commands that failed.
+ */
+static size_t run_jobs(std::vector<ScriptJob>& jobs, size_t n_workers,
+                       Executor& executor) {
+    size_t n_failed = 0;
+    size_t n_started = 0;
+    size_t n_running = 0;
+    // the jobs before this one have finished and been written out
+    size_t head = 0;
+    // after an error: the number of jobs to finish
+    size_t n_jobs = jobs.size();
+    std::vector<pollfd> fds;
+    std::vector<size_t> owners;
+    while (head < n_jobs) {
+        while (n_started < n_jobs && n_running < n_workers) {
+            try {
+                start(jobs[n_started], executor);
+            }
+            catch (std::runtime_error& e) {
+                std::cerr << "clash: " << e.what() << std::endl;
+                n_failed += n_jobs - n_started;
+                n_jobs = n_started;
+                break;
+            }
+            ++n_started;
+            ++n_running;
+        }
+
+        fds.clear();
+        owners.clear();
+        for (size_t i = head; i < n_started; ++i) {
+            for (int fd : jobs[i].fds) {
+                if (fd == -1) continue;
+                fds.push_back({fd, POLLIN, 0});
+                owners.push_back(i);
+            }
+        }
+        if (!fds.empty() && poll(fds.data(), fds.size(), -1) == -1) {
+            if (errno == EINTR) continue;
+            std::cerr << "clash: poll: " << strerror(errno) << std::endl;
+            n_failed += n_jobs - n_started;
+            n_jobs = n_started;
+            for (size_t i = head; i < n_started; ++i) {
+                if (jobs[i].done) continue;
+                reap(jobs[i]);
+                // its output may be incomplete
+                if (jobs[i].status == 0) ++n_failed;
+            }
+            n_running = 0;
+            fds.clear();
+        }
+        for (size_t k = 0; k < fds.size(); ++k) {
+            if (!fds[k].revents) continue;
+            ScriptJob& job = jobs[owners[k]];
+            int stream = job.fds[0] == fds[k].fd ? 0 : 1;
+            char buffer[4096];
+            ssize_t n_read = read(fds[k].fd, buffer, sizeof(buffer));
+            if (n_read == -1 && errno == EINTR) continue;
+            if (n_read > 0) {
+                job.buffers[stream].append(buffer, n_read);
+                continue;
+            }
+            close(fds[k].fd);
+            job.fds[stream] = -1;
+            if (job.fds[0] == -1 && job.fds[1] == -1) {
+                reap(job);
+                --n_running;
+            }
+        }
+
+        // the earliest unfinished job streams its output
+        while (head < n_started) {
+            ScriptJob& job = jobs[head];
+            flush(job);
+            if (!job.done) break;
+            if (job.status != 0) {
+                ++n_failed;
+                std::cerr << "clash: line " << job.line_number
+                          << ": exit status " << job.status << std::endl;
+            }
+            ++head;
+        }
+    }
+    return n_failed;
+}
+
+/*
+ * Reads a script whose commands are independent of each other, and executes
+ * them in parallel: the "-j N" mode described in Clash.h.
+ */
+void run_parallel(std::istream& file, size_t n_workers, Executor& executor) {
+    std::vector<ScriptJob> jobs;
+    size_t n_commands = 0;
+    size_t n_failed = 0;
+    auto run_segment = [&]() {
+        n_commands += jobs.size();
+        if (jobs.size() == 1) {
+            // nothing to run alongside it: run it in the shell, which keeps
+            // its side effects
+            if (!execute(executor, jobs[0].text)) executor.set_status(1);
+            if (executor.status() != 0) {
+                ++n_failed;
+                std::cerr << "clash: line " << jobs[0].line_number
+                          << ": exit status " << executor.status()
+                          << std::endl;
+            }
+        }
+        else if (!jobs.empty()) {
+            n_failed += run_jobs(jobs, n_workers, executor);
+        }
+        jobs.clear();
+    };
+
+    // the lines of an incomplete command read so far
+    std::string input;
+    size_t line_number = 0;
+    size_t start_line = 0;
+    std::string line;
+    while (getline(file, line)) {
+        ++line_number;
+        if (input.empty()) {
+            size_t first = line.find_first_not_of(" \t");
+            size_t last = line.find_last_not_of(" \t");
+            std::string_view trimmed;
+            if (first != std::string::npos) {
+                trimmed = std::string_view(line).substr(first,
+                                                        last + 1 - first);
+            }
+            if (trimmed.empty() || trimmed == "wait") {
+                run_segment();
+                if (!trimmed.empty()) execute(executor, line);
+                continue;
+            }
+            start_line = line_number;
+        }
+        input += line;
+        try {
+            executor.check_syntax(input);
+        }
+        catch (Executor::IncompleteInputException& e) {
+            input += '\n';
+            continue;
+        }
+        catch (Executor::ExecutorException& e) {
+            // reported by the worker that executes it
+        }
+        jobs.push_back(ScriptJob{input, start_line});
+        input.clear();
+    }
+    run_segment();
+
+    if (!input.empty()) {
+        std::cerr << "clash: syntax error: unexpected end of file" << std::endl;
+        ++n_failed;
+    }
+    if (n_failed > 0) {
+        std::cerr << "clash: " << n_failed << " of " << n_commands
+                  << " commands failed" << std::endl;
+    }
+    executor.set_status(std::min<size_t>(n_failed, 125));
+}
+
 void Clash::run(std::vector<std::string> args) {
+    // -j N: run independent commands in parallel
+    size_t n_workers = 0;
+    if (args.size() >= 3 && args[1] == "-j") {
+        char *end;
+        long n = strtol(args[2].c_str(), &end, 10);
+        if (*end || n < 1 || args.size() > 4) {
+            std::cerr << "clash: usage: clash -j N [file]" << std::endl;
+            return;
+        }
+        n_workers = n;
+        args.erase(args.begin() + 1, args.begin() + 3);
+    }
     Executor executor(args);
     // case #1: input from stdin
     if (args.size() == 1) {
         bool is_terminal = (isatty(STDIN_FILENO) == 1);
-        repl(std::cin, is_terminal, executor);
+        if (n_workers) {
+            run_parallel(std::cin, n_workers, executor);
+        } else {
+            repl(std::cin, is_terminal, executor);
+        }
     }
     // case #2: input from file
     else if (args.size() == 2) {
@@ -56,20 +361,15 @@ void Clash::run(std::vector<std::string> args) {
             std::cerr << "clash: " << strerror(errno) << std::endl;
             return;
         }
-        repl(file, false, executor);
+        if (n_workers) {
+            run_parallel(file, n_workers, executor);
+        } else {
+            repl(file, false, executor);
+        }
     }
     // case #3: shell script
-    else if (args.size() == 3 && args[1] == "-c") {
-        try {
-            executor.execute_command(args[1]);
-        }
-        catch (Executor::ExecutorException& e) {
-            std::cerr << "clash: " << e.what() << std::endl;
-        }
-        catch (std::exception& e) {
-            std::cerr << "clash: " << e.what() << std::endl;
-            LOG_F(INFO, "uncaught exception: %s", e.what());
-        }
+    else if (args.size() == 3 && args[1] == "-c" && !n_workers) {
+        execute(executor, args[2]);
     }
     else {
         std::cerr << "clash: Invalid arguments" << std::endl;
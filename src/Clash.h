@@ -10,13 +10,31 @@
  *
  * Usage: 
  * - If no arguments are passed, clash will read commands from standard input. 
- *   A '%' prompt is used for terminals.  
+ *   A '%' prompt is used for terminals, and a '>' prompt while a command
+ *   continues onto further lines.
  *
  * - If the first argument is "-c", then the 2nd argument must be a shell script, 
  *   which clash will execute and then exit. 
  *
  * - Otherwise, the first argument must be the name of a file, from which clash
  *   will execute commands and exit once it reaches the end of the file.    
+ *
+ * - "clash -j N [file]" runs a script (the file, or standard input) of
+ *   independent commands, up to N at a time, each in a forked copy of the
+ *   shell:
+ *   - Blank lines and lines that are just "wait" are barriers: every
+ *     command before one finishes before any after it starts.
+ *   - A command alone between barriers runs in the shell itself, so that
+ *     setup (variables, functions, cd) can be done in lines of its own.
+ *   - Each command's output is buffered and written out in the order of the
+ *     script; that of the earliest unfinished command as it arrives.
+ *   - Each failed command is reported on standard error as "clash: line L:
+ *     exit status S" after its output, and the failures are counted at the
+ *     end ("clash: F of T commands failed").
+ *   - If a command can't be started (no pipe or process to be had), no
+ *     more commands are started: those running are finished, and those
+ *     not run count as failed.
+ *   - The exit status is the number of failed commands, at most 125.
  */ 
 
 class Clash {
@@ -0,0 +1,119 @@
+#include "Environment.h"
+#include <cstring>
+
+using std::string;
+using std::string_view;
+
+const char* Environment::find(string_view name)
+{
+    if (_imported) {
+        auto it = _variables.find(string(name));
+        return it != _variables.end() ? it->second.c_str() : nullptr;
+    }
+    if (!_indexed) {
+        for (char **entry = _inherited; entry && *entry; ++entry) {
+            if (const char *eq = std::strchr(*entry, '=')) {
+                _index.emplace(string_view(*entry, eq - *entry), eq + 1);
+            }
+        }
+        _indexed = true;
+    }
+    auto it = _index.find(name);
+    return it != _index.end() ? it->second : nullptr;
+}
+
+void Environment::set(string_view name, string_view value)
+{
+    import();
+    string &binding = _variables[string(name)];
+    if (binding != value) {
+        binding = value;
+        ++_generation;
+    }
+}
+
+void Environment::unset(string_view name)
+{
+    import();
+    if (_variables.erase(string(name))) ++_generation;
+}
+
+char** Environment::envp()
+{
+    if (!_imported) return _inherited;
+    if (_envp_generation == _generation) return _envp.data();
+
+    size_t size = 0;
+    for (const auto &[name, value] : _variables) {
+        size += name.size() + value.size() + 2;
+    }
+    _block.clear();
+    _block.reserve(size);
+    for (const auto &[name, value] : _variables) {
+        _block.append(name).append(1, '=').append(value).append(1, '\0');
+    }
+
+    /* point into the block only once it's complete (and won't move) */
+    _envp.clear();
+    for (size_t pos = 0; pos < _block.size();
+         pos = _block.find('\0', pos) + 1) {
+        _envp.push_back(&_block[pos]);
+    }
+    _envp.push_back(nullptr);
+    _envp_generation = _generation;
+    return _envp.data();
+}
+
+char** Environment::envp(const std::vector<string_view,
+                                           ArenaAllocator<string_view>>
+                             &assignments,
+                         Arena &arena)
+{
+    auto name_of = [](string_view assignment) {
+        return assignment.substr(0, assignment.find('='));
+    };
+    /* true if a later assignment to the same name takes precedence */
+    auto is_overridden = [&](string_view name, size_t from) {
+        for (size_t i = from; i < assignments.size(); ++i) {
+            if (name_of(assignments[i]) == name) return true;
+        }
+        return false;
+    };
+
+    char **base = envp();
+    size_t n_base = 0;
+    while (base && base[n_base]) ++n_base;
+    char **block = static_cast<char **>(
+        arena.allocate((n_base + assignments.size() + 1) * sizeof(char *),
+                       alignof(char *)));
+
+    size_t n = 0;
+    for (size_t i = 0; i < n_base; ++i) {
+        const char *eq = std::strchr(base[i], '=');
+        string_view name = eq ? string_view(base[i], eq - base[i]) : base[i];
+        if (!is_overridden(name, 0)) block[n++] = base[i];
+    }
+    for (size_t i = 0; i < assignments.size(); ++i) {
+        if (!is_overridden(name_of(assignments[i]), i + 1)) {
+            block[n++] = const_cast<char *>(assignments[i].data());
+        }
+    }
+    block[n] = nullptr;
+    return block;
+}
+
+/**
+ * Copy the inherited environment into the table, so that it can be changed.
+ * Like getenv, only the first entry for each name counts.
+ */
+void Environment::import()
+{
+    if (_imported) return;
+    for (char **entry = _inherited; entry && *entry; ++entry) {
+        if (const char *eq = std::strchr(*entry, '=')) {
+            _variables.emplace(string(*entry, eq - *entry), eq + 1);
+        }
+    }
+    _imported = true;
+    _index.clear();
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include "util/arena.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * The exported variables of a shell session, i.e. the environment passed to
+ * the executables it launches.
+ *
+ * The shell's own process environment is never modified. Instead, exported
+ * variables are kept in a table, which is materialized into a contiguous
+ * envp block (a single buffer of "NAME=value" strings, plus the pointer
+ * array) when an executable is launched, but only if the table has changed
+ * since the block was last built. Until the first change, the inherited
+ * environment is passed on as is, without being copied.
+ */
+class Environment {
+  public:
+    /** @param inherited The environment the shell was started with. */
+    Environment(char **inherited) : _inherited(inherited) {}
+
+    /** Returns the value of an exported variable, or nullptr if 'name'
+        isn't exported. Valid until the next change. */
+    const char* find(std::string_view name);
+
+    /** Export 'name' with 'value', replacing any previous value. */
+    void set(std::string_view name, std::string_view value);
+
+    /** Stop exporting 'name'. */
+    void unset(std::string_view name);
+
+    /** Returns the environment block for launching executables. Valid until
+        the next change. */
+    char** envp();
+
+    /**
+     * Returns an environment block for a single command, with the
+     * 'assignments' ("NAME=value" strings that must stay valid as long as the
+     * block) added to or replacing the exported variables. The block is
+     * allocated from 'arena'; the table itself is left unchanged.
+     */
+    char** envp(const std::vector<std::string_view, 
+                                  ArenaAllocator<std::string_view>>
+                    &assignments,
+                Arena &arena);
+
+  private:
+    char **_inherited;
+    /* set once the inherited environment has been copied into _variables,
+       on the first change */
+    bool _imported = false;
+    /* until then, the inherited entries' values by name (views into the
+       entries), indexed on the first lookup */
+    bool _indexed = false;
+    std::unordered_map<std::string_view, const char*> _index;
+    std::unordered_map<std::string, std::string> _variables;
+    /* incremented on every change to _variables */
+    uint64_t _generation = 1;
+    /* the generation that _block and _envp were built for */
+    uint64_t _envp_generation = 0;
+    std::string _block;
+    std::vector<char*> _envp;
+
+    void import();
+};
@@ -0,0 +1,97 @@
+#include "ExecutableCache.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::string;
+using std::string_view;
+
+namespace {
+    /* how long an open descriptor is trusted to match its path */
+    const auto kRecheckInterval = std::chrono::seconds(1);
+}
+
+ExecutableCache::Entry::~Entry()
+{
+    if (fd != -1) close(fd);
+}
+
+#ifdef __linux__
+
+int ExecutableCache::find(string_view path)
+{
+    std::unique_ptr<Entry> *entry = _entries.get(path);
+    auto now = std::chrono::steady_clock::now();
+    if (entry && now - (*entry)->checked >= kRecheckInterval) {
+        struct stat st;
+        if (stat((*entry)->path.c_str(), &st) == 0 && 
+            st.st_dev == (*entry)->dev && st.st_ino == (*entry)->ino) {
+            (*entry)->checked = now;
+        }
+        else {
+            entry = nullptr; // replaced (or removed) since it was opened
+        }
+    }
+    if (!entry) {
+        open_executable(path);
+        entry = _entries.get(path);
+        if (!entry) return -1; // capacity 0
+    }
+    return (*entry)->fd;
+}
+
+void ExecutableCache::exclude(string_view path)
+{
+    std::unique_ptr<Entry> entry(
+        new Entry{string(path), -1, 0, 0, std::chrono::steady_clock::now()});
+    string_view key = entry->path;
+    _entries.put(key, std::move(entry));
+}
+
+/**
+ * Open an O_PATH descriptor for an executable and cache it, or cache an 
+ * entry without one if it is a script (or can't be opened).
+ */
+void ExecutableCache::open_executable(string_view path)
+{
+    std::unique_ptr<Entry> entry(
+        new Entry{string(path), -1, 0, 0, std::chrono::steady_clock::now()});
+    string_view key = entry->path;
+    const char *c_path = entry->path.c_str();
+
+    /* scripts start with '#!'; files we can't read are assumed not to be
+       scripts, and the caller falls back to the path if exec fails */
+    int file_fd = open(c_path, O_RDONLY | O_CLOEXEC);
+    bool is_script = false;
+    if (file_fd != -1) {
+        char magic[2] = {};
+        is_script = read(file_fd, magic, sizeof(magic)) == 2 && 
+                    magic[0] == '#' && magic[1] == '!';
+        close(file_fd);
+    }
+
+    if (!is_script) {
+        int fd = open(c_path, O_PATH | O_CLOEXEC);
+        struct stat st;
+        if (fd != -1 && fstat(fd, &st) == 0) {
+            entry->fd = fd;
+            entry->dev = st.st_dev;
+            entry->ino = st.st_ino;
+        }
+        else if (fd != -1) {
+            close(fd);
+        }
+    }
+    _entries.put(key, std::move(entry));
+}
+
+#else
+
+int ExecutableCache::find(string_view)
+{
+    return -1;
+}
+
+void ExecutableCache::exclude(string_view) {}
+
+#endif
@@ -0,0 +1,58 @@
+#pragma once
+#include "util/lru_cache.h"
+#include <chrono>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+
+/**
+ * Keeps an O_PATH file descriptor open for each recently launched
+ * executable, so that it can be started with execveat(fd, "", ...,
+ * AT_EMPTY_PATH) instead of having the kernel resolve its path again on
+ * every exec.
+ *
+ * The descriptors are close-on-exec and bounded in number (least recently
+ * used ones are closed first). Each is checked against the inode currently
+ * at its path at most once per second, and reopened if the file has been
+ * replaced.
+ *
+ * Scripts are never given a descriptor: the kernel runs them by handing the
+ * interpreter a /dev/fd/N path, which doesn't survive a close-on-exec
+ * descriptor.
+ *
+ * Only available on Linux; elsewhere find() always returns -1.
+ */
+class ExecutableCache {
+  public:
+    /** @param capacity The most descriptors to keep open. */
+    ExecutableCache(size_t capacity) : _entries(capacity) {}
+
+    /**
+     * Returns a descriptor for the executable at 'path' (opening it if
+     * necessary), or -1 if it should be launched by path instead.
+     */
+    int find(std::string_view path);
+
+    /** Stop using a descriptor for 'path' (e.g. it turned out unusable). */
+    void exclude(std::string_view path);
+
+    void set_capacity(size_t capacity) { _entries.set_capacity(capacity); }
+
+  private:
+    struct Entry {
+        ~Entry();
+
+        std::string path;
+        /* -1 for executables launched by path */
+        int fd;
+        dev_t dev;
+        ino_t ino;
+        std::chrono::steady_clock::time_point checked;
+    };
+
+    /* keyed by a view of the entry's own path */
+    LRUCache<std::string_view, std::unique_ptr<Entry>> _entries;
+
+    void open_executable(std::string_view path);
+};
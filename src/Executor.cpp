@@ -1,25 +1,36 @@
 #include "Executor.h"
-#include "util/string_utils.cpp"
+#include "Arithmetic.h"
+#include <algorithm>
+#include <charconv>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <exception>
+#include <optional>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <poll.h>
-#include <filesystem>
 #include <fcntl.h>
+#include <spawn.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+extern char **environ;
 
-namespace fs = std::filesystem;
 using std::string;
+using std::string_view;
 using std::vector;
 
-bool is_properly_formatted_var(const string& input);
-std::unordered_set<std::string> extract_paths_from_PATH();
-
 const static string kPATH_default = 
     "/usr/local/bin:/usr/local/sbin:/usr/bin:/usr/sbin:/bin:/sbin";
+/* deeper recursion would overflow the stack */
+const static int kMaxFunctionDepth = 1000;
+/* the status of a pipeline stage whose process hasn't been waited for */
+const static int kStageRunning = -1;
 
 /** 
  * Development notes: 
@@ -35,28 +46,30 @@ const static string kPATH_default =
  * @param argv the argv-style args a clash executable would've received, but 
  *             in string/vector form. First arg should be the executable name. 
  */
- Executor::Executor(const vector<std::string>& argv) {
-    _PATHs = extract_paths_from_PATH();
-
+ Executor::Executor(const vector<std::string>& argv) 
+   : _environment(environ) {
     // add custom variables
-    _var_bindings["PATH"] = getenv("PATH");
+    char *PATH = getenv("PATH");
+    LOG_F(INFO, "existing PATH variable was %s", 
+          (PATH ? "found" : "not found"));
+    _variables.set("PATH", PATH ? PATH : kPATH_default);
+    if (char *cache_file = getenv("CLASH_PATH_CACHE")) {
+        _path_cache_file = cache_file;
+        update_path_index();
+        _path_index.load(_path_cache_file);
+    }
+    if (char *max_jobs = getenv("CLASH_MAX_JOBS")) {
+        _options.max_jobs = strtoul(max_jobs, nullptr, 10);
+    }
     if (!argv.empty()) {
-        _var_bindings["0"] = argv[0];
-        int zero_idx = 0;
+        size_t zero_idx = 0;
         if (argv.size() > 3 && argv[1] == "-c") {
-            _var_bindings["0"] = argv[3];
             zero_idx = 3;
         } else if (argv.size() == 2) {
-            _var_bindings["0"] = argv[1];
             zero_idx = 1;
         }
-        for (int i = zero_idx + 1; i < argv.size(); ++i) {
-            _var_bindings[std::to_string(i - zero_idx)] = argv[i];
-        }
-        _var_bindings["#"] = std::to_string(argv.size() - zero_idx - 1);
-        string concat;
-        for (const string& elem : argv) concat += elem + " ";
-        _var_bindings["*"] = concat; 
+        _variables.set_positional(vector<string>(argv.begin() + zero_idx, 
+                                                 argv.end()));
     }
  }
 
@@ -66,34 +79,103 @@ const static string kPATH_default =
  * most recently executed command. 
  */
  Executor::~Executor() {
-     exit(std::stoi(_var_bindings["?"]));
+     save_path_cache();
+     stats();
+     LOG_F(INFO, "parse cache: %zu hits, %zu misses", 
+           _stats.parse_cache_hits, _stats.parse_cache_misses);
+     LOG_F(INFO, "PATH index: %zu hits, %zu negative hits, "
+           "%zu directory reads", _stats.path_hits, _stats.path_negative_hits,
+           _stats.path_directory_reads);
+     // exit() skips the destructors of the members
+     _jobs.release_tokens();
+     exit(_variables.status());
  }
 
 
 /**
  * Execute a CLASH script, writing to standard output. 
  * 
+ * All scratch memory used while expanding and launching the script's 
+ * commands comes from the command arena, which is reset after each of its
+ * top-level commands, and once the outermost call returns.
+ * 
  * @param input The CLASH script to be executed.
+ * 
+ * @throws IncompleteInputException if the script ends in the middle of a 
+ *         command. (Incomplete command substitutions are plain 
+ *         ExecutorExceptions, since more input can't complete them.)
  */
-void Executor::execute_command(string input)
+void Executor::execute_command(const string& input)
 {
-    vector<Command> commands;
-    divide_into_commands(input, commands);
-
-    vector<pid_t> pipeline_pids;
-    for (Command &c : commands) eval_command(c, pipeline_pids);
-
-    /* pipelines only: wait for entire pipeline to finish, and capture last
-       command's status. */
-    for (int i = 0; i < pipeline_pids.size(); ++i) {
-        int status;
-        waitpid(pipeline_pids[i], &status, 0);
-        if (i == pipeline_pids.size() - 1) {
-            _var_bindings["?"] = std::to_string(status);
+    ++_execution_depth;
+    std::shared_ptr<const ast::CommandList> outer_list = _current_list;
+    try {
+        try {
+            _current_list = parse(input);
         }
+        catch (IncompleteInputException &e) {
+            if (_execution_depth > 1) throw ExecutorException(e.what());
+            throw;
+        }
+        execute_sequence(_current_list->body);
+    }
+    catch (...) {
+        _current_list = std::move(outer_list);
+        if (--_execution_depth == 0) {
+            _captures.clear();
+            _arena.reset();
+            _control = Control::None;
+            _loop_depth = 0;
+        }
+        throw;
+    }
+    _current_list = std::move(outer_list);
+    if (--_execution_depth == 0) {
+        _captures.clear();
+        _arena.reset();
+        _control = Control::None;
     }
 }
 
+/**
+ * Parse a CLASH script, reusing the parse tree from an earlier execution of
+ * the same script when it is still cached. Parse trees hold no expanded
+ * values, so they can be reused no matter how variables have changed.
+ * 
+ * @param input The CLASH script to be parsed.
+ * 
+ * @return The parse tree, which remains valid even if it is later evicted
+ *         from the cache.
+ */
+std::shared_ptr<const ast::CommandList> Executor::parse(string_view input)
+{
+    _parse_cache.set_capacity(_options.parse_cache_capacity);
+    if (auto *cached = _parse_cache.get(input)) {
+        ++_stats.parse_cache_hits;
+        return *cached;
+    }
+
+    ++_stats.parse_cache_misses;
+    auto list = std::make_shared<ast::CommandList>(input);
+    Parser(*list).parse();
+    // the key views the tree's own copy of the input, so it lives as long
+    // as the entry does
+    _parse_cache.put(list->source, list);
+    return list;
+}
+
+
+/**
+ * Returns the executor's counters, up to date.
+ */
+const Executor::Stats& Executor::stats()
+{
+    _stats.path_hits = _path_index.n_remembered_hits;
+    _stats.path_negative_hits = _path_index.n_missing_hits;
+    _stats.path_directory_reads = _path_index.n_directory_reads;
+    return _stats;
+}
+
 
 /** 
  * Mirrors the 'execute_command' method exactly, but returns its standard 
@@ -101,589 +183,1440 @@ void Executor::execute_command(string input)
  * 
  * @param input the CLASH script to be executed. 
  */
-std::string Executor::execute_command_and_capture_output(std::string input) {
-    // 1: temporarily redirect stdout to a pipe
-    int stdout_copy = dup(STDOUT_FILENO);
-    int fds[2];
-    pipe(fds);
-    dup2(fds[1], STDOUT_FILENO);
-    close(fds[1]);
+std::string Executor::execute_command_and_capture_output(const string& input) {
+    CaptureBuffer buffer(_options.capture_spill_threshold);
+    capture_output(input, buffer);
+    return string(buffer.view());
+}
 
-    // 2: execute the command 
+/**
+ * Execute a CLASH script with its standard output going into 'buffer'.
+ * 
+ * The output pipe is drained on a separate thread while the script runs, so
+ * commands writing more than a pipe's worth of output (64 KiB on Linux) are
+ * never blocked waiting for the shell, which is itself busy running them.
+ * 
+ * @param input The CLASH script to be executed.
+ * @param buffer Receives everything the script writes to standard output.
+ */
+void Executor::capture_output(const string& input, CaptureBuffer& buffer)
+{
+    // 1: make a pipe the default output of the commands. Nothing else
+    // needs to inherit it, so both ends are close-on-exec; executables get
+    // the write end through their output_fd.
+    int fds[2];
+    if (pipe(fds) == -1) {
+        throw ExecutorException(string("pipe: ") + strerror(errno));
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    int output_fd = _output_fd;
+    _output_fd = fds[1];
+    // the enclosing command's prefetched substitutions must survive the
+    // commands run here, which clear their own
+    decltype(_substitution_outputs) outputs;
+    std::swap(outputs, _substitution_outputs);
+
+    // 2: execute the command while draining its output. The reader sees
+    // end-of-file once the write end is closed and every child has exited.
+    int drain_error = 0;
+    std::thread reader([&]() {
+        if (!buffer.drain(fds[0])) drain_error = errno;
+    });
+    auto teardown = [&]() {
+        _output_fd = output_fd;
+        std::swap(outputs, _substitution_outputs);
+        close(fds[1]);
+        reader.join();
+        close(fds[0]);
+    };
     try {
         Executor::execute_command(input);
     }
     catch (...) {
-        // restore stdout - must complete "teardown" after "setup" here too!
-        dup2(stdout_copy, STDOUT_FILENO);
-        close(stdout_copy);
+        // restore output - must complete "teardown" after "setup" here too!
+        teardown();
         throw;
     }
+    teardown();
 
-    // 3: read captured output
-    string result;
-    struct pollfd pfd {fds[0], POLL_IN, 0};
-    // only attempt to read if there's data (hangs otherwise)
-    if (poll(&pfd, 1, 0) > 0) {
-        char buf[512];
-        int bytes_read = read(fds[0], buf, sizeof(buf));
-        result = string(buf, bytes_read);
+    if (drain_error) {
+        throw ExecutorException(string("command substitution: ") + 
+                                strerror(drain_error));
+    }
+}
+
+/**
+ * Run all command substitutions of a command at once, so that the command
+ * waits for the slowest of them rather than their sum. Each runs in a forked
+ * subshell writing into its own pipe, and the pipes are drained together in
+ * a poll() loop. The outputs are recorded in _substitution_outputs, where
+ * expand_part() finds them.
+ * 
+ * A lone substitution runs in a subshell too, so that whether side effects
+ * survive never depends on how many substitutions a command has: as in other
+ * shells, variable assignments and directory changes made by substitutions
+ * do not outlive them. $? is set to the exit status of the last one. (Those
+ * in the word of '${name:-word}' only run if the word is needed, so they are
+ * left to expand_part(), inside the shell.)
+ * 
+ * @param node The command whose substitutions (in its assignments, words, 
+ *             and redirections) are to be run.
+ * 
+ * @throws ExecutorException with the error of the leftmost substitution that
+ *         failed, after all of them have finished.
+ */
+void Executor::run_substitutions_in_parallel(const ast::SimpleCommand &node)
+{
+    vector<const ast::WordPart*> parts;
+    auto collect = [&](const ast::Word &word) {
+        for (const ast::WordPart &part : word.parts) {
+            if (part.kind == ast::WordPart::Kind::CommandSub) {
+                parts.push_back(&part);
+            }
+        }
+    };
+    for (const ast::Assignment &assignment : node.assignments) {
+        collect(assignment.value);
+    }
+    for (const ast::Word &word : node.words) collect(word);
+    for (const ast::Redirection &redirection : node.redirections) {
+        collect(redirection.target);
+    }
+    if (parts.empty()) return;
+
+    /* one subshell per substitution */
+    struct Substitution {
+        pid_t pid = -1;
+        int output_fd = -1;
+        /* the subshell writes the message of an exception here */
+        int error_fd = -1;
+        CaptureBuffer *buffer = nullptr;
+    };
+    vector<Substitution> subs(parts.size());
+    auto close_all = [&]() {
+        for (Substitution &sub : subs) {
+            if (sub.output_fd != -1) close(sub.output_fd);
+            if (sub.error_fd != -1) close(sub.error_fd);
+            if (sub.pid != -1) waitpid(sub.pid, nullptr, 0);
+        }
+    };
+
+    for (size_t i = 0; i < parts.size(); ++i) {
+        int output_fds[2], error_fds[2];
+        if (pipe(output_fds) == -1) {
+            close_all();
+            throw ExecutorException(string("pipe: ") + strerror(errno));
+        }
+        if (pipe(error_fds) == -1) {
+            close(output_fds[0]);
+            close(output_fds[1]);
+            close_all();
+            throw ExecutorException(string("pipe: ") + strerror(errno));
+        }
+        for (int fd : {output_fds[0], output_fds[1], error_fds[0], 
+                       error_fds[1]}) {
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(output_fds[0]);
+            close(error_fds[0]);
+            _output_fd = output_fds[1];
+            int status = 1;
+            try {
+                execute_command(string(parts[i]->text));
+                status = _variables.status();
+            }
+            catch (std::exception &e) {
+                ssize_t ignored = write(error_fds[1], e.what(), 
+                                        strlen(e.what()));
+                (void) ignored;
+            }
+            _exit(status);
+        }
+        int fork_errno = errno;
+        close(output_fds[1]);
+        close(error_fds[1]);
+        subs[i].output_fd = output_fds[0];
+        subs[i].error_fd = error_fds[0];
+        if (pid == -1) {
+            close_all();
+            throw ExecutorException(string("fork: ") + strerror(fork_errno));
+        }
+        subs[i].pid = pid;
+        _captures.push_back(std::make_unique<CaptureBuffer>(
+            _options.capture_spill_threshold));
+        subs[i].buffer = _captures.back().get();
+    }
+
+    /* drain every pipe until all of them reach end-of-file */
+    vector<struct pollfd> pfds;
+    for (Substitution &sub : subs) pfds.push_back({sub.output_fd, POLLIN, 0});
+    size_t n_open = subs.size();
+    int drain_error = 0;
+    while (n_open > 0) {
+        if (poll(pfds.data(), pfds.size(), -1) == -1) {
+            if (errno == EINTR) continue;
+            drain_error = errno;
+            break;
+        }
+        for (size_t i = 0; i < subs.size(); ++i) {
+            if (pfds[i].fd == -1 || pfds[i].revents == 0) continue;
+            ssize_t n_read = subs[i].buffer->fill(pfds[i].fd);
+            if (n_read == -1 && errno == EINTR) continue;
+            if (n_read <= 0) {
+                if (n_read == -1) drain_error = errno;
+                // negative fds are ignored by poll()
+                pfds[i].fd = -1;
+                --n_open;
+            }
+        }
     }
 
-    // 4: restore stdout
-    dup2(stdout_copy, STDOUT_FILENO);
-    close(stdout_copy);
+    /* collect exit statuses and errors */
+    string error;
+    int status = 0;
+    for (Substitution &sub : subs) {
+        waitpid(sub.pid, &status, 0);
+        sub.pid = -1;
+        if (error.empty()) {
+            char buf[1024];
+            ssize_t n_read = read(sub.error_fd, buf, sizeof(buf));
+            if (n_read > 0) error.assign(buf, n_read);
+        }
+    }
+    close_all();
+    if (!error.empty()) throw ExecutorException(error);
+    if (drain_error) {
+        throw ExecutorException(string("command substitution: ") + 
+                                strerror(drain_error));
+    }
 
-    return result;
+    _variables.set_status(JobTable::exit_status(status));
+    for (size_t i = 0; i < parts.size(); ++i) {
+        _substitution_outputs.emplace_back(parts[i], subs[i].buffer->view());
+    }
 }
 
 /**
- * Divide a CLASH script into pipelines and commands.
- * 
- * As pipelines are detected, pipes are created, and the Command structs'
- * input_fd and output_fd fields are initialized with the ends of the pipes.
+ * Release the scratch memory of the commands executed so far, unless
+ * something expanded into it may still be in use: that is, only between the
+ * top-level commands of the outermost script (including those in the bodies
+ * of its loops), and not inside command substitutions.
+ */
+void Executor::release_scratch()
+{
+    if (_execution_depth != 1) return;
+    _captures.clear();
+    _arena.reset();
+}
+
+/**
+ * Execute a sequence of commands, stopping early for a 'break' or 
+ * 'continue'. Background jobs that have finished are reaped after each
+ * command.
+ */
+void Executor::execute_sequence(const ast::Sequence &sequence)
+{
+    for (const ast::AndOr &and_or : sequence.items) {
+        if (and_or.background) {
+            start_job(and_or);
+        } else {
+            execute_and_or(and_or);
+        }
+        if (!_jobs.empty()) _jobs.reap();
+        release_scratch();
+        if (_control != Control::None) return;
+    }
+}
+
+/**
+ * Execute pipelines joined by '&&' and '||': each runs only if the status 
+ * of the one before it is zero ('&&') or nonzero ('||').
+ */
+void Executor::execute_and_or(const ast::AndOr &and_or)
+{
+    execute_pipeline(and_or.pipelines[0]);
+    for (size_t i = 1; i < and_or.pipelines.size(); ++i) {
+        if (_control != Control::None) return;
+        bool succeeded = _variables.status() == 0;
+        if (succeeded != 
+            (and_or.connectors[i - 1] == ast::AndOr::Connector::And)) {
+            continue;
+        }
+        execute_pipeline(and_or.pipelines[i]);
+    }
+}
+
+/**
+ * Start an and-or list in the background, as a job, and set $! to the pid of
+ * its last process. A single pipeline is launched like one in the 
+ * foreground, just not waited for; a longer list runs in a forked subshell.
  * 
- * @param input A string containing clash script.
- * @param commands An empty vector, which will be populated with the commands.
+ * When Options::max_jobs jobs are already running (or make's jobserver has
+ * no token to spare), this first waits for a slot.
  */
-void Executor::divide_into_commands(string input, vector<Command> &commands)
+void Executor::start_job(const ast::AndOr &and_or)
 {
-    input += ';'; /* enforce input terminated by command separator */
+    bool holds_token = _jobs.acquire_slot(job_limit(), _options.jobserver);
 
-    /* PARSING STATE FLAGS */
-    bool backslashed = false;
-    bool double_quoted = false;
-    bool single_quoted = false;
-    bool command_sub = false;
-    bool var_name = false;
-    bool should_pipe = false;
+    vector<pid_t> pids;
+    bool negated = false;
+    try {
+        launch_job(and_or, pids, negated);
+    }
+    catch (...) {
+        if (holds_token) _jobs.release_token();
+        throw;
+    }
+    if (!pids.empty()) _variables.set_background_pid(pids.back());
+    _jobs.add(std::move(pids), and_or.source, negated, holds_token);
+    _variables.set_status(0);
+}
 
-    /* stores current accumulated command as we scan the input script */
-    string cmd {};
+/** The most jobs to run at once: Options::max_jobs, or the online CPUs. */
+size_t Executor::job_limit() const
+{
+    static const size_t online_cpus = std::max(sysconf(_SC_NPROCESSORS_ONLN),
+                                               1L);
+    return _options.max_jobs ? _options.max_jobs : online_cpus;
+}
 
-    for (int i = 0; i < input.length(); i++) {
-        switch (input[i]) {
-            case '\\':
-                if (!single_quoted && !var_name) backslashed = !backslashed;
-                cmd += '\\';
-                continue;
-            case '\'':
-                if (!backslashed && !double_quoted && !var_name) {
-                    single_quoted = !single_quoted;
-                }
-                break;
-            case '"':
-                if (!backslashed && !single_quoted && !var_name) {
-                    double_quoted = !double_quoted;
-                }
-                break;
-            case '`':
-                if (!backslashed && !single_quoted && !var_name) {
-                    command_sub = !command_sub;
-                }
-                break;
-            case '$':
-                if (!backslashed && !single_quoted && !var_name && 
-                    input[i+1] == '{') { var_name = true; }
-                break;
-            case '}':
-                var_name = false;
-                break;
-            /* COMMAND SEPARATORS */
-            case '|':
-            case ';':
-            case '\n':
-                if (backslashed || single_quoted || double_quoted || 
-                    command_sub || var_name) break;
-                /* add accumulated command to list and reset accumulator;
-                 * empty commands are ignored (unless part of a pipeline) */
-                string_utils::trim(cmd);
-                if (!cmd.empty()) commands.emplace_back(cmd);
-                else if (should_pipe) {
-                    throw ExecutorException("Incomplete pipeline");
-                }
-                else continue;
-                cmd.clear();
-
-                /* CASE: set up pipeline from previous command to this one */
-                if (should_pipe) {
-                    int pipe_fds[2];
-                    pipe(pipe_fds);
-
-                    commands.at(commands.size() - 2).output_fd = pipe_fds[1];
-                    commands.at(commands.size() - 1).input_fd = pipe_fds[0];
-                    commands.at(commands.size() - 2).is_part_of_pipeline = true;
-                    commands.at(commands.size() - 1).is_part_of_pipeline = true;
+/** Start the processes of a job, for start_job(). */
+void Executor::launch_job(const ast::AndOr &and_or, vector<pid_t> &pids,
+                          bool &negated)
+{
+    if (and_or.pipelines.size() == 1) {
+        negated = and_or.pipelines[0].negated;
+        launch_pipeline(and_or.pipelines[0], pids, true);
+    } else {
+        pid_t pid = fork();
+        if (pid == -1) throw ExecutorException(strerror(errno));
+        if (pid == 0) {
+            int status = 1;
+            try {
+                int null_fd = open("/dev/null", O_RDONLY);
+                if (null_fd != -1) {
+                    dup2(null_fd, STDIN_FILENO);
+                    close(null_fd);
                 }
+                execute_and_or(and_or);
+                status = _variables.status();
+            }
+            catch (std::exception &e) {
+                fprintf(stderr, "clash: %s\n", e.what());
+            }
+            _exit(status);
+        }
+        pids.push_back(pid);
+    }
+}
 
-                should_pipe = (input[i] == '|');
-                continue;
+/**
+ * Execute a pipeline of one or more commands.
+ * 
+ * Pipes are created between consecutive commands as they are launched, and
+ * the Command structs' input_fd and output_fd fields are initialized with
+ * the ends of the pipes. A compound command runs inside the shell when it
+ * is a pipeline of its own, and in a forked child otherwise.
+ * 
+ * @param pipeline The pipeline to be executed.
+ */
+void Executor::execute_pipeline(const ast::Pipeline &pipeline)
+{
+    if (pipeline.commands.size() == 1 && pipeline.commands[0].compound &&
+        pipeline.commands[0].simple.redirections.empty()) {
+        const ast::Command &command = pipeline.commands[0];
+        if (command.function_name.empty()) {
+            execute_compound(*command.compound);
+        } else {
+            define_function(command);
         }
+        int status = _variables.status();
+        finish_pipeline(pipeline, &status, 1);
+        return;
+    }
 
-        /* adding a normal character to the accumulating command */
-        backslashed = false;
-        cmd += input[i];
+    vector<pid_t> pipeline_pids;
+    if (pipeline.commands.size() == 1) {
+        // runs inside the shell, or waits for its own process
+        launch_pipeline(pipeline, pipeline_pids, false);
+        int status = _variables.status();
+        finish_pipeline(pipeline, &status, 1);
+        return;
     }
+    vector<int> statuses;
+    launch_pipeline(pipeline, pipeline_pids, false, &statuses);
+    wait_for_stages(pipeline_pids, statuses);
+    finish_pipeline(pipeline, statuses.data(), statuses.size());
+}
 
-    if (single_quoted) {
-        throw ExecutorException("Unterminated single quotes");
+/**
+ * Set $? and $PIPESTATUS from the statuses of a pipeline's stages. $? is 
+ * that of the last stage or, with the 'pipefail' option, of the last stage
+ * that failed; '!' then inverts it. $PIPESTATUS is never inverted.
+ */
+void Executor::finish_pipeline(const ast::Pipeline &pipeline, 
+                               const int *statuses, size_t n_stages)
+{
+    int status = statuses[n_stages - 1];
+    if (_options.pipefail) {
+        for (size_t i = 0; i < n_stages; ++i) {
+            if (statuses[i] != 0) status = statuses[i];
+        }
     }
-    if (double_quoted) {
-        throw ExecutorException("Unterminated double quotes");
+    if (n_stages > 1 || pipeline.negated) {
+        _variables.set_pipe_status(statuses, n_stages);
+    } else {
+        // the same as $?
+        _variables.set_pipe_status(nullptr, 0);
     }
-    if (command_sub) {
-        throw ExecutorException("Unterminated command substitution");
+    _variables.set_status(pipeline.negated ? status == 0 : status);
+}
+
+/**
+ * Wait for the processes of a pipeline, recording their decoded statuses in
+ * the entries of 'statuses' that are kStageRunning (which belong, in order,
+ * to 'pids').
+ * 
+ * Each process of a longer pipeline is watched through a pidfd, and reaped
+ * as soon as it exits, whatever its place in the pipeline: a stage that
+ * dies early is collected right away, rather than lingering as a zombie 
+ * until the stages before it are done. Where pidfds are unavailable, the 
+ * processes are waited for in order.
+ */
+void Executor::wait_for_stages(const vector<pid_t> &pids, 
+                               vector<int> &statuses)
+{
+    // the stage of each process
+    vector<size_t> stages;
+    stages.reserve(pids.size());
+    for (size_t i = 0; i < statuses.size(); ++i) {
+        if (statuses[i] == kStageRunning) stages.push_back(i);
+    }
+    auto reap = [&](size_t k) {
+        int wait_status = 0;
+        while (waitpid(pids[k], &wait_status, 0) == -1 && errno == EINTR) {}
+        statuses[stages[k]] = JobTable::exit_status(wait_status);
+    };
+
+    vector<struct pollfd> fds(pids.size(), {-1, POLLIN, 0});
+    size_t n_watched = 0;
+#if defined(__linux__) && defined(SYS_pidfd_open)
+    if (pids.size() > 1) {
+        for (size_t k = 0; k < pids.size(); ++k) {
+            fds[k].fd = syscall(SYS_pidfd_open, pids[k], 0);
+            if (fds[k].fd != -1) ++n_watched;
+        }
     }
-    if (backslashed) {
-        throw ExecutorException("Backslash appears as last character of line");
+#endif
+    while (n_watched > 0) {
+        // (poll skips the entries of processes already reaped, at -1)
+        if (poll(fds.data(), fds.size(), -1) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (size_t k = 0; k < fds.size(); ++k) {
+            if (fds[k].fd == -1 || !fds[k].revents) continue;
+            reap(k);
+            close(fds[k].fd);
+            fds[k].fd = -1;
+            --n_watched;
+        }
     }
-    if (var_name) {
-        throw ExecutorException("Unterminated braces for variable name");
+    for (size_t k = 0; k < pids.size(); ++k) {
+        if (fds[k].fd != -1) close(fds[k].fd);
+        if (statuses[stages[k]] == kStageRunning) reap(k);
     }
 }
 
 /**
- * Execute a CLASH command.
+ * Launch the commands of a pipeline, connecting consecutive ones with pipes.
  * 
- * @param cmd The command to be executed.
- * @param pipeline_pids Output parameter to be populated with the pid of the
- *                      executed child process if 'cmd' is part of a pipeline. 
+ * @param pipeline_pids Output parameter to be populated with the pids of the
+ *                      commands that run in child processes.
+ * @param background If 'true', every command runs in a child process, with 
+ *                   /dev/null as its standard input unless redirected.
+ * @param stage_statuses If not null, populated with the status of each 
+ *                       command that ran inside the shell, and 
+ *                       kStageRunning for each that runs in a child.
  */
-void Executor::eval_command(Command &cmd, vector<pid_t>& pipeline_pids)
+void Executor::launch_pipeline(const ast::Pipeline &pipeline, 
+                               vector<pid_t>& pipeline_pids, bool background,
+                               vector<int> *stage_statuses)
 {
-    cmd.bash_str = process_special_syntax(cmd.bash_str);
-    vector<string> words;
-    divide_into_words(cmd, words);
-    if (words.empty()) return;
+    size_t n_commands = pipeline.commands.size();
+    /* read end of the pipe from the previous command, if any */
+    int pipe_read_fd = STDIN_FILENO;
+    if (background) {
+        pipe_read_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (pipe_read_fd == -1) {
+            throw ExecutorException(string("/dev/null: ") + strerror(errno));
+        }
+    }
+    try {
+        for (size_t i = 0; i < n_commands; ++i) {
+            Command cmd(_arena, _output_fd);
+            cmd.is_part_of_pipeline = (n_commands > 1) || background;
+            cmd.in_background = background;
+            cmd.input_fd = pipe_read_fd;
+            pipe_read_fd = STDIN_FILENO;
+
+            /* CASE: set up pipeline from this command to the next one */
+            if (i + 1 < n_commands) {
+                int pipe_fds[2];
+                if (pipe(pipe_fds) == -1) {
+                    throw ExecutorException(strerror(errno));
+                }
+                fcntl(pipe_fds[0], F_SETFD, FD_CLOEXEC);
+                fcntl(pipe_fds[1], F_SETFD, FD_CLOEXEC);
+                cmd.output_fd = pipe_fds[1];
+                cmd.output_is_pipe = true;
+                pipe_read_fd = pipe_fds[0];
+            }
 
-    // case #1: variable assignment
-    if (words.size() == 1 && is_properly_formatted_var(words[0])) {
-        int eq_idx = words[0].find('=');
-        string var = words[0].substr(0, eq_idx);
-        string val = words[0].substr(eq_idx + 1); 
-        _var_bindings[var] = val; 
-        LOG_F(INFO, "performed variable binding for %s : %s", 
-              var.c_str(), val.c_str());
-    } 
-    // case #2: builtin commands
-    else if (words[0] == "cd") {
+            size_t n_children = pipeline_pids.size();
+            const ast::Command &command = pipeline.commands[i];
+            if (!command.function_name.empty()) {
+                define_function(command);
+            } else if (command.compound) {
+                // 'simple' only holds the compound command's redirections
+                _substitution_outputs.clear();
+                if (_options.parallel_substitutions) {
+                    run_substitutions_in_parallel(command.simple);
+                }
+                apply_redirections(command.simple.redirections, cmd);
+                _substitution_outputs.clear();
+                run_compound(*command.compound, cmd, pipeline_pids);
+            } else {
+                eval_command(command.simple, cmd, pipeline_pids);
+            }
+            if (stage_statuses) {
+                stage_statuses->push_back(pipeline_pids.size() > n_children
+                                          ? kStageRunning 
+                                          : _variables.status());
+            }
+        }
+    }
+    catch (...) {
+        // don't leave the pipe or already-launched children behind
+        if (pipe_read_fd != STDIN_FILENO) close(pipe_read_fd);
+        for (pid_t pid : pipeline_pids) waitpid(pid, nullptr, 0);
+        throw;
+    }
+}
+
+/**
+ * Run a compound command with a command's input and output: inside the 
+ * shell, or in a forked child if it is a stage of a larger pipeline.
+ * 
+ * @param pipeline_pids Output parameter to be populated with the pid of the
+ *                      child, if there is one.
+ */
+void Executor::run_compound(const ast::CompoundCommand &compound, 
+                            Command &cmd, vector<pid_t>& pipeline_pids)
+{
+    if (!cmd.is_part_of_pipeline) {
+        // swap in the command's input and output for the duration
+        int output_fd = _output_fd;
+        int saved_input_fd = -1;
+        if (cmd.input_fd != STDIN_FILENO) {
+            saved_input_fd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+            dup2(cmd.input_fd, STDIN_FILENO);
+        }
+        _output_fd = cmd.output_fd;
+        auto restore = [&]() {
+            _output_fd = output_fd;
+            if (saved_input_fd != -1) {
+                dup2(saved_input_fd, STDIN_FILENO);
+                close(saved_input_fd);
+            }
+        };
         try {
-            fs::current_path((words[1]));
+            execute_compound(compound);
         }
         catch (...) {
-            string msg = "cd: " + words[1] + ": " + strerror(errno);
-            throw ExecutorException(msg); 
+            restore();
+            throw;
         }
+        restore();
+        return;
     }
-    else if (words[0] == "exit") {
-        int status_code = 0;
-        if (words.size() > 1) {
-            try {
-                status_code = std::stoi(words[1]); 
-            }
-            catch (...){
-                string msg = 
-                    "exit: " + words[1] + ": numeric argument required";
-                throw ExecutorException(msg); 
+
+    pid_t pid = fork();
+    if (pid == -1) throw ExecutorException(strerror(errno));
+    if (pid == 0) {
+        int status = 1;
+        try {
+            if (cmd.input_fd != STDIN_FILENO) {
+                dup2(cmd.input_fd, STDIN_FILENO);
             }
+            _output_fd = cmd.output_fd;
+            execute_compound(compound);
+            status = _variables.status();
+        }
+        catch (std::exception &e) {
+            fprintf(stderr, "clash: %s\n", e.what());
         }
-        exit(status_code);
-    }
-    else if (words[0] == "export") {
-        // export each existing var as an environment variable
-        for (int i = 1; i < words.size(); ++i) {
-            if (_var_bindings.count(words[i])) {
-                int status = setenv(words[i].c_str(), 
-                                    _var_bindings[words[i]].c_str(), 1);
-                if (status == -1) {
-                    // bash behavior: do nothing for invalid variable
-                    LOG_F(INFO, "export: invalid var: %s", words[i].c_str()); 
+        _exit(status);
+    }
+    pipeline_pids.push_back(pid);
+}
+
+/**
+ * Execute a compound command inside the shell. Its status is that of the 
+ * last command it executed, or 0 if it executed none (besides conditions).
+ */
+void Executor::execute_compound(const ast::CompoundCommand &compound)
+{
+    using Kind = ast::CompoundCommand::Kind;
+    switch (compound.kind) {
+        case Kind::If:
+            for (size_t i = 0; i < compound.conditions.size(); ++i) {
+                execute_sequence(compound.conditions[i]);
+                if (_control != Control::None) return;
+                if (_variables.status() == 0) {
+                    execute_sequence(compound.bodies[i]);
+                    return;
                 }
             }
+            // 'else'
+            if (compound.bodies.size() > compound.conditions.size()) {
+                execute_sequence(compound.bodies.back());
+            } else {
+                _variables.set_status(0);
+            }
+            return;
+        case Kind::While:
+        case Kind::Until:
+            execute_while(compound);
+            return;
+        case Kind::For:
+            execute_for(compound);
+            return;
+        case Kind::Case:
+            execute_case(compound);
+            return;
+        case Kind::Group:
+            execute_sequence(compound.bodies[0]);
+            return;
+    }
+}
+
+void Executor::execute_while(const ast::CompoundCommand &loop)
+{
+    bool until = loop.kind == ast::CompoundCommand::Kind::Until;
+    int status = 0;
+    ++_loop_depth;
+    while (true) {
+        execute_sequence(loop.conditions[0]);
+        if (_control == Control::None) {
+            if ((_variables.status() == 0) == until) break;
+            execute_sequence(loop.bodies[0]);
+            status = _variables.status();
         }
+        if (finish_iteration()) break;
     }
-    else if (words[0] == "unset") {
-        // delete each existing var (both in environment and bindings map)
-        for (int i = 1; i < words.size(); ++i) {
-            if (_var_bindings.count(words[i])) {
-                int status = unsetenv(words[i].c_str());
-                if (status == -1) {
-                    // bash behavior: do nothing for invalid variable
-                    LOG_F(INFO, "unset: invalid var: %s", words[i].c_str());
-                }
-                _var_bindings.erase(words[i]);
+    --_loop_depth;
+    _variables.set_status(status);
+}
+
+/**
+ * Execute a 'for' loop. The words are expanded once, up front, and copied
+ * out of the command arena, which the body's commands reset.
+ */
+void Executor::execute_for(const ast::CompoundCommand &loop)
+{
+    vector<string> values;
+    if (loop.has_in) {
+        Words fields(_arena);
+        for (const ast::Word &word : loop.words) expand_word(word, fields);
+        values.assign(fields.begin(), fields.end());
+    } else {
+        const vector<string> &positional = _variables.positional();
+        if (!positional.empty()) {
+            values.assign(positional.begin() + 1, positional.end());
+        }
+    }
+
+    int status = 0;
+    ++_loop_depth;
+    for (const string &value : values) {
+        assign_variable(loop.variable, value);
+        execute_sequence(loop.bodies[0]);
+        status = _variables.status();
+        if (finish_iteration()) break;
+    }
+    --_loop_depth;
+    _variables.set_status(status);
+}
+
+/**
+ * Execute the body of the first case item with a pattern matching the 
+ * subject. Patterns are tried in order, and only compiled here if they
+ * contain expansions.
+ */
+void Executor::execute_case(const ast::CompoundCommand &compound)
+{
+    string_view subject = expand_word_to_string(compound.subject);
+    _variables.set_status(0);
+    for (const ast::CaseItem &item : compound.items) {
+        for (size_t i = 0; i < item.patterns.size(); ++i) {
+            bool matched = item.compiled[i] 
+                ? item.compiled[i]->matches(subject)
+                : GlobPattern(expand_pattern(item.patterns[i]))
+                      .matches(subject);
+            if (matched) {
+                execute_sequence(item.body);
+                return;
             }
         }
     }
-    // case #3: executable
+}
+
+/**
+ * Called by a loop after each iteration, to act on a 'break' or 'continue'
+ * executed during it.
+ * 
+ * @return 'true' if the loop must end: for 'break' and 'return', or for a
+ *         'break' or 'continue' that applies to an enclosing loop.
+ */
+bool Executor::finish_iteration()
+{
+    if (_control == Control::None) return false;
+    if (_control == Control::Return) return true;
+    if (--_control_levels > 0) return true;
+    bool stop = _control == Control::Break;
+    _control = Control::None;
+    return stop;
+}
+
+/**
+ * Expand and execute a CLASH command.
+ * 
+ * @param node The parsed command to be executed.
+ * @param cmd The command's execution state, with input_fd and output_fd
+ *            already set up if it is part of a pipeline. 
+ * @param pipeline_pids Output parameter to be populated with the pid of the
+ *                      executed child process if 'cmd' is part of a pipeline. 
+ */
+void Executor::eval_command(const ast::SimpleCommand &node, Command &cmd, 
+                            vector<pid_t>& pipeline_pids)
+{
+    _substitution_outputs.clear();
+    if (_options.parallel_substitutions) run_substitutions_in_parallel(node);
+
+    Words &words = cmd.words;
+    words.reserve(node.words.size());
+    for (const ast::Word &word : node.words) expand_word(word, words);
+    apply_redirections(node.redirections, cmd);
+
+    // case #1: variable assignment (in the background, it would happen in a
+    // subshell, and so have no effect)
+    if (!node.assignments.empty() && words.empty()) {
+        if (cmd.in_background) {
+            _substitution_outputs.clear();
+            return;
+        }
+        for (const ast::Assignment &assignment : node.assignments) {
+            string_view val = expand_word_to_string(assignment.value);
+            assign_variable(assignment.name, val);
+            LOG_F(INFO, "performed variable binding for %s : %s", 
+                  string(assignment.name).c_str(), val.data());
+        }
+        _substitution_outputs.clear();
+        return;
+    } 
+    // prefix assignments only go into the command's environment
+    for (const ast::Assignment &assignment : node.assignments) {
+        string_view val = expand_word_to_string(assignment.value);
+        cmd.assignments.push_back(
+            _arena.concat(string(assignment.name) + "=", val));
+    }
+    _substitution_outputs.clear();
+    if (words.empty()) return;
+
+    // case #2: shell functions
+    auto function = _functions.find(words[0]);
+    if (function != _functions.end()) {
+        call_function(function->second, cmd, pipeline_pids);
+        return;
+    }
+
+    // case #3: builtin commands
+    auto builtin = kBuiltins.find(words[0]);
+    if (builtin != kBuiltins.end() && 
+        (builtin->second.kind != Builtin::Kind::Utility ||
+         _options.builtin_utils)) {
+        run_builtin(builtin->second, cmd, pipeline_pids);
+    }
+    // case #4: executable
     else {
-        string input_cmd = words[0];
-        string complete_cmd;
-        // case 1: path is specified explicitly
-        if (input_cmd[0] == '/') {
-            if (access(input_cmd.c_str(), X_OK) != 0) {
+        string_view input_cmd = words[0];
+        const char *complete_cmd = nullptr;
+        // case 1: a path (anything with a '/') is used as is
+        if (input_cmd.find('/') != string_view::npos) {
+            if (access(input_cmd.data(), X_OK) != 0) {
                 throw ExecutorException(strerror(errno));
             }
-            complete_cmd = input_cmd;
-        }
-        // case 2: check if the command is cached
-        else if (_cached_command_paths.count(input_cmd)) {
-            complete_cmd = _cached_command_paths[input_cmd];
-            LOG_F(INFO, "cached path found: %s", complete_cmd.c_str());
+            complete_cmd = input_cmd.data();
         }
-        // case 3: manually search PATH  
+        // case 2: search PATH
         else {
-            for (const std::string& base_path : _PATHs) {
-                string attempt_path = base_path + "/" + input_cmd;
-                if (access(attempt_path.c_str(), X_OK) == 0) {
-                    complete_cmd = attempt_path;
-                    _cached_command_paths[input_cmd] = complete_cmd;
-                    LOG_F(INFO, "full executable path found: %s", 
-                          complete_cmd.c_str());
-                    break;
-                }
-            }
+            complete_cmd = find_executable(input_cmd);
         }
         // if we got here, we couldn't find a path to the executable. 
-        if (complete_cmd == "") {
-            throw ExecutorException("command not found: " + input_cmd);
+        if (!complete_cmd) {
+            throw ExecutorException("command not found: " + string(input_cmd));
         }
 
-        /* execute command */
-        pid_t pid = fork();
-        if (pid == 0) {
-            // setup i/o
-            dup2(cmd.input_fd, STDIN_FILENO);
-            dup2(cmd.output_fd, STDOUT_FILENO);
-            // prepare argv
-            vector<char *> argv (words.size() + 1);
-            argv[0] = &complete_cmd[0];
-            for (int i = 1; i < words.size(); ++i) {
-                argv[i] = &words[i][0];
-            }
-            argv.back() = nullptr;
-
-            execv(argv[0], argv.data());
-        } 
+        // prepare argv (in the arena, so nothing is allocated per launch)
+        char **argv = static_cast<char **>(
+            _arena.allocate((words.size() + 1) * sizeof(char *), 
+                            alignof(char *)));
+        argv[0] = const_cast<char *>(complete_cmd);
+        for (size_t i = 1; i < words.size(); ++i) {
+            argv[i] = const_cast<char *>(words[i].data());
+        }
+        argv[words.size()] = nullptr;
 
-        // parent: close pipes (stdin/out aren't pipes, so don't close em)
-        if (cmd.input_fd != STDIN_FILENO) close(cmd.input_fd);
-        if (cmd.output_fd != STDOUT_FILENO) close(cmd.output_fd);
+        /* execute command */
+        pid_t pid = launch_executable(cmd, argv);
 
-        // parent: wait for child
+        // parent: wait for child (the Command closes its pipes/files)
         if (cmd.is_part_of_pipeline) {
             // pipelines run concurrently -> wait for this child later
             pipeline_pids.push_back(pid);
         } else {
             int status;
-            waitpid(pid, &status, 0);
-            if (WIFEXITED(status)) {
-                _var_bindings["?"] = std::to_string(WEXITSTATUS(status));
-            }
+            while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {}
+            _variables.set_status(JobTable::exit_status(status));
         }
     }
 }
 
 /**
- * Process backslashes, single quotes, double quotes, variable substitutions, 
- * and command substitutions for a given CLASH command string.
- * 
- * The returned command is the result of processing these special syntax
- * features on the input command. The two special syntax features present in
- * the returned command are single quotes and backslashes, which escape
- * spaces/tabs that should not be treated as word separators, "<"/">"
- * characters that should not be treated as I/O redirection operators, single
- * quotes, and other backslashes.
- * 
- * @param cmd The raw CLASH command string to be processed.
- * 
- * @return The processed CLASH command string, in which single quotations may
- * be present and a backslash is an escape character.
+ * Expand the file names of redirections, and open the files as the 
+ * command's input or output (the last of each kind wins).
  */
-string Executor::process_special_syntax(const string &cmd)
+void Executor::apply_redirections(
+    const vector<ast::Redirection> &redirections, Command &cmd)
 {
-    string processed_cmd {};
+    for (const ast::Redirection &redirection : redirections) {
+        const char *fname = expand_word_to_string(redirection.target).data();
+        if (redirection.kind == ast::Redirection::Kind::Input) {
+            cmd.redirect_input(fname);
+        } else {
+            cmd.redirect_output(fname);
+        }
+    }
+}
 
-    /* PARSING STATE FLAGS */
-    bool backslashed = false;
-    bool double_quoted = false;
-    bool single_quoted = false;
-    bool var_sub = false, name_in_braces = false;
-    bool command_sub = false;
+/**
+ * Define (or redefine) a shell function. The function keeps the parse tree
+ * being executed, which holds its body, alive.
+ */
+void Executor::define_function(const ast::Command &command)
+{
+    // the old entry's key may view the old tree, so it is replaced entirely
+    _functions.erase(command.function_name);
+    _functions.emplace(command.function_name, 
+                       Function{_current_list, command.compound.get(),
+                                &command.simple.redirections});
+    _variables.set_status(0);
+}
 
-    string var_name {};
-    string subcommand {};
+/**
+ * Apply a command's prefix assignments to the shell itself, exported, for
+ * a function or builtin that runs inside it.
+ * 
+ * @return What the variables were, for restore_variables().
+ */
+vector<Executor::SavedVariable> Executor::assign_temporarily(
+    const Command &cmd)
+{
+    vector<SavedVariable> saved;
+    saved.reserve(cmd.assignments.size());
+    for (string_view assignment : cmd.assignments) {
+        size_t eq = assignment.find('=');
+        string_view name = assignment.substr(0, eq);
+        SavedVariable &variable = saved.emplace_back();
+        variable.name = name;
+        if (auto value = _variables.find(name)) variable.value = *value;
+        if (const char *value = _environment.find(name)) {
+            variable.exported = value;
+        }
+        _variables.set(name, assignment.substr(eq + 1));
+        _environment.set(name, assignment.substr(eq + 1));
+    }
+    return saved;
+}
 
-    for (int i = 0; i < cmd.length(); i++) {
-        /* SINGLE QUOTATION ENVIRONMENT */
-        if (single_quoted) {
-            processed_cmd += cmd[i];
-            if (cmd[i] == '\'') single_quoted = false;
-            continue;
+/**
+ * Undo assign_temporarily(), in reverse order, so that a name assigned twice
+ * ends up as it was before the first.
+ */
+void Executor::restore_variables(const vector<SavedVariable> &saved)
+{
+    for (auto it = saved.rbegin(); it != saved.rend(); ++it) {
+        if (it->value) {
+            _variables.set(it->name, *it->value);
+        } else {
+            _variables.unset(it->name);
+        }
+        if (it->exported) {
+            _environment.set(it->name, *it->exported);
+        } else {
+            _environment.unset(it->name);
         }
+    }
+}
 
-        /* ACCUMULATING VARIABLE NAME */
-        if (var_sub) {
-            static const string ONE_CHAR_VARS = "#*?";
-            /* set to true if we should switch on cmd[i] this iteration */
-            bool exceeded_name_scope = false;
-            /* CASE: process first character of variable name */
-            if (var_name.empty()) {
-                if (ONE_CHAR_VARS.find(cmd[i]) != string::npos) {
-                    var_name += cmd[i];
-                    var_sub = false;
-                }
-                else if (cmd[i] == '{') name_in_braces = true;
-                else if (std::isalnum(cmd[i])) var_name += cmd[i];
-                else var_sub = false;
-            }
-            else if (name_in_braces) {
-                if (cmd[i] == '}') {
-                    name_in_braces = false;
-                    var_sub = false;
+/**
+ * Call a shell function: its body runs (inside the shell, unless the call
+ * is a stage of a larger pipeline) with the command's arguments as the 
+ * positional parameters, and the redirections of its definition. Prefix
+ * assignments ('X=1 f') are in effect, and exported, for the duration of the
+ * call. 'break' and 'continue' don't reach the caller's loops, and 'return'
+ * ends the call.
+ * 
+ * @param function A copy of the function, which keeps its tree alive even 
+ *                 if the body redefines it.
+ * @param cmd The expanded command. Its words are copied into the positional
+ *            parameters up front, since the body's commands may reset the
+ *            command arena.
+ * @param pipeline_pids Output parameter to be populated with the pid of the
+ *                      forked child, if there is one.
+ */
+void Executor::call_function(Function function, Command &cmd, 
+                             vector<pid_t>& pipeline_pids)
+{
+    if (_function_depth >= kMaxFunctionDepth) {
+        throw ExecutorException(string(cmd.words[0]) + 
+                                ": maximum function nesting level exceeded");
+    }
+    vector<SavedVariable> saved = assign_temporarily(cmd);
+    _variables.push_positional(cmd.words.data() + 1, cmd.words.size() - 1);
+    int loop_depth = _loop_depth;
+    _loop_depth = 0;
+    ++_function_depth;
+    // definitions made by the body belong to the function's tree
+    std::swap(_current_list, function.tree);
+    auto restore = [&]() {
+        std::swap(_current_list, function.tree);
+        --_function_depth;
+        _loop_depth = loop_depth;
+        _variables.pop_positional();
+        restore_variables(saved);
+        if (_control == Control::Return) _control = Control::None;
+    };
+    try {
+        apply_redirections(*function.redirections, cmd);
+        run_compound(*function.body, cmd, pipeline_pids);
+    }
+    catch (...) {
+        restore();
+        throw;
+    }
+    restore();
+}
+
+/**
+ * Run a builtin command and record its exit status in $?.
+ * 
+ * Builtins normally run inside the shell process. The exceptions are 
+ * builtins run in the background, and a builtin other than a special one 
+ * (e.g. 'echo') writing into a pipe to a later pipeline stage: they run in a
+ * forked child, like an executable, so that (e.g.) filling the pipe can't
+ * block the shell before the reader has been started.
+ * 
+ * Prefix assignments ('X=1 printf ...') are in effect while a builtin other
+ * than a special one runs, as they would be in the environment of the
+ * executable it stands in for.
+ * 
+ * @param builtin The builtin to run.
+ * @param cmd The expanded command.
+ * @param pipeline_pids Output parameter to be populated with the pid of the
+ *                      forked child, if there is one.
+ */
+void Executor::run_builtin(const Builtin &builtin, Command &cmd, 
+                           vector<pid_t>& pipeline_pids)
+{
+    if ((builtin.kind != Builtin::Kind::Special && cmd.output_is_pipe) ||
+        cmd.in_background) {
+        pid_t pid = fork();
+        if (pid == -1) throw ExecutorException(strerror(errno));
+        if (pid == 0) {
+            int status = 1;
+            try {
+                if (builtin.kind != Builtin::Kind::Special) {
+                    assign_temporarily(cmd);
                 }
-                else var_name += cmd[i];
+                status = (this->*builtin.fn)(cmd);
             }
-            /* CASE: if a non-alphanumeric character is encountered, or if the 
-             * variable name is supposed to be a digit and a non-digit character
-             * is enounctered, end the variable name accumulation */
-            else if (!std::isalnum(cmd[i]) ||
-                    (std::isdigit(var_name[0]) && !std::isdigit(cmd[i]))) {
-                var_sub = false;
-                exceeded_name_scope = true;
+            catch (std::exception &e) {
+                fprintf(stderr, "clash: %s\n", e.what());
             }
-            else var_name += cmd[i];
-
-            /* CASE: variable name accumulation ends in this iteration */
-            if (!var_sub || i == cmd.length() - 1) {
-                if (var_name.empty()) {
-                    throw ExecutorException("empty/invalid variable name");
-                }
+            _exit(status);
+        }
+        pipeline_pids.push_back(pid);
+        return;
+    }
 
-                // even if the var doesn't exist, this is correct (emtpy str)
-                processed_cmd += _var_bindings[var_name];
+    if (builtin.kind == Builtin::Kind::Special || cmd.assignments.empty()) {
+        _variables.set_status((this->*builtin.fn)(cmd));
+        return;
+    }
+    vector<SavedVariable> saved = assign_temporarily(cmd);
+    int status;
+    try {
+        status = (this->*builtin.fn)(cmd);
+    }
+    catch (...) {
+        restore_variables(saved);
+        throw;
+    }
+    restore_variables(saved);
+    _variables.set_status(status);
+}
 
-                if (!exceeded_name_scope) continue;
-            }
-            /* CASE: still accumulating variable name, continue to cmd[i+1] */
-            else continue;
-        }
-
-        /* ACCUMULATING SUBCOMMAND */
-        if (command_sub) {
-            if (cmd[i] == '`' && cmd[i - 1] != '\\') command_sub = false;
-            else subcommand += cmd[i];
-
-            /* CASE: subcommand accumulation ended in this iteration */
-            if (!command_sub) {
-                // run the subcommand and insert its output 
-                string result = execute_command_and_capture_output(subcommand);
-                // remove trailing newline
-                if (result.back() == '\n') result.pop_back();
-                // word break on newlines and tabs
-                std::replace(result.begin(), result.end(), '\n', ' ');
-                std::replace(result.begin(), result.end(), '\t', ' ');
-                processed_cmd += result;
-            }
+/**
+ * Start an executable as a child process with the command's input/output.
+ * 
+ * By default the child is created with posix_spawn, which avoids copying
+ * the shell's page tables (vfork-style) and is therefore much cheaper than
+ * fork() when the shell's address space is large. The fork() path is used
+ * when the 'posix_spawn' option is turned off.
+ * 
+ * The child's environment is the exported variables, plus the command's
+ * prefix assignments.
+ * 
+ * @param cmd The command, whose input_fd and output_fd become the child's 
+ *            standard input and output.
+ * @param argv Null-terminated argument array; argv[0] is the full path.
+ * 
+ * @return The pid of the child.
+ * 
+ * @throws ExecutorException if the child could not be started.
+ */
+pid_t Executor::launch_executable(const Command &cmd, char **argv)
+{
+    char **envp = cmd.assignments.empty() 
+        ? _environment.envp() : _environment.envp(cmd.assignments, _arena);
+
+    if (_options.execveat) {
+        _executables.set_capacity(_options.exec_fd_cache_capacity);
+        int exec_fd = _executables.find(argv[0]);
+        if (exec_fd != -1) {
+            return launch_executable_fd(cmd, exec_fd, argv, envp);
+        }
+    }
 
-            continue;  
+    if (_options.posix_spawn) {
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        if (cmd.input_fd != STDIN_FILENO) {
+            posix_spawn_file_actions_adddup2(&actions, cmd.input_fd, 
+                                             STDIN_FILENO);
+        }
+        if (cmd.output_fd != STDOUT_FILENO) {
+            posix_spawn_file_actions_adddup2(&actions, cmd.output_fd, 
+                                             STDOUT_FILENO);
         }
 
-        /* SPECIAL SYNTAX */
-        switch (cmd[i]) {
-            case '\\':
-                if (backslashed) processed_cmd += '\\';
-                backslashed = !backslashed;
-                continue;
-            case '"':
-                if (backslashed) {
-                    processed_cmd += '"';
-                    backslashed = false;
-                }
-                else {
-                    /* transform double quote environments into single quotes */
-                    processed_cmd += '\'';
-                    double_quoted = !double_quoted;
-                }
-                continue;
-            case '\'':
-                if (double_quoted) processed_cmd += '\\';
-                processed_cmd += '\'';
-                if (backslashed || double_quoted) backslashed = false;
-                /* begin single quotation environment */
-                else single_quoted = true;
-                continue;
-            case '$':
-                if (backslashed) {
-                    processed_cmd += '$';
-                    backslashed = false;
-                }
-                /* begin accumulating variable name */
-                else {
-                    var_sub = true;
-                    name_in_braces = false;
-                    var_name.clear();
-                }
-                continue;
-            case '`':
-                if (backslashed) {
-                    processed_cmd += '`';
-                    backslashed = false;
-                }
-                /* begin accumulating subcommand */
-                else {
-                    command_sub = true;
-                    subcommand.clear();
-                }
-                continue;
-            /* word separation and redirection are handled later, so preserve
-             * their escaping */
-            case ' ':
-            case '\t':
-            case '<':
-            case '>':
-                if (backslashed && !double_quoted) processed_cmd += '\\';
-            default:
-                backslashed = false;
-                processed_cmd += cmd[i];
-                break;
+        pid_t pid;
+        int err = posix_spawn(&pid, argv[0], &actions, nullptr, argv, envp);
+        posix_spawn_file_actions_destroy(&actions);
+        if (err != 0) {
+            _variables.set_status(127);
+            throw ExecutorException(string(argv[0]) + ": " + strerror(err));
         }
+        return pid;
     }
 
-    if (name_in_braces) {
-        throw ExecutorException("unterminated braces for variable name");
-    }
-    if (single_quoted) {
-        throw ExecutorException("unterminated single quotes");
-    }
-    if (double_quoted) {
-        throw ExecutorException("unterminated double quotes");
+    pid_t pid = fork();
+    if (pid == -1) throw ExecutorException(strerror(errno));
+    if (pid == 0) {
+        // setup i/o
+        dup2(cmd.input_fd, STDIN_FILENO);
+        dup2(cmd.output_fd, STDOUT_FILENO);
+
+        execve(argv[0], argv, envp);
+        // only reached if the exec failed
+        fprintf(stderr, "clash: %s: %s\n", argv[0], strerror(errno));
+        _exit(127);
+    } 
+    return pid;
+}
+
+/**
+ * Start an executable from an open (O_PATH) descriptor of it, with vfork() and
+ * execveat(), so the kernel doesn't have to walk its path again. Like 
+ * posix_spawn, vfork doesn't copy the shell's page tables; the child only 
+ * sets up its input/output and execs.
+ * 
+ * If the kernel can't exec the descriptor (no execveat, or a script that 
+ * slipped past ExecutableCache), the child execs the path instead, and the 
+ * executable is launched by path from then on.
+ * 
+ * @param cmd The command, whose input_fd and output_fd become the child's 
+ *            standard input and output.
+ * @param exec_fd Descriptor of the executable, from _executables.
+ * @param argv Null-terminated argument array; argv[0] is the full path.
+ * @param envp Null-terminated environment block.
+ * 
+ * @return The pid of the child.
+ * 
+ * @throws ExecutorException if the child could not be started.
+ */
+pid_t Executor::launch_executable_fd(const Command &cmd, int exec_fd, 
+                                     char **argv, char **envp)
+{
+#ifdef __linux__
+    /* the child shares our memory until it execs, so it can report back */
+    volatile int exec_errno = 0;
+    volatile bool used_path = false;
+
+    pid_t pid = vfork();
+    if (pid == 0) {
+        if (cmd.input_fd != STDIN_FILENO) dup2(cmd.input_fd, STDIN_FILENO);
+        if (cmd.output_fd != STDOUT_FILENO) dup2(cmd.output_fd, STDOUT_FILENO);
+        syscall(SYS_execveat, exec_fd, "", argv, envp, AT_EMPTY_PATH);
+        if (errno == ENOENT || errno == ENOSYS) {
+            used_path = true;
+            execve(argv[0], argv, envp);
+        }
+        exec_errno = errno;
+        _exit(127);
     }
-    if (command_sub) {
-        throw ExecutorException("unterminated command substitution");
+    if (pid == -1) throw ExecutorException(strerror(errno));
+
+    if (used_path) _executables.exclude(argv[0]);
+    if (exec_errno) {
+        waitpid(pid, nullptr, 0);
+        _variables.set_status(127);
+        throw ExecutorException(string(argv[0]) + ": " + 
+                                strerror(exec_errno));
     }
-    if (backslashed) {
-        throw ExecutorException("backslash appears as last character of line");
+    return pid;
+#else
+    (void) exec_fd;
+    (void) envp;
+    return launch_executable(cmd, argv);
+#endif
+}
+
+/**
+ * Returns the value of a variable or special parameter, or "" if it isn't 
+ * set.
+ * 
+ * Variables inherited from the environment are imported one at a time, the
+ * first time each is referenced, rather than all at startup: a process with 
+ * a huge environment pays nothing for the variables it never uses. Names 
+ * that aren't set anywhere are not remembered.
+ * 
+ * @param name The variable name.
+ */
+string_view Executor::lookup_variable(string_view name)
+{
+    if (auto value = _variables.find(name)) return *value;
+    if (const char *value = _environment.find(name)) {
+        _variables.set(name, value);
+        return *_variables.find(name);
     }
+    return "";
+}
 
-    return processed_cmd;
+/**
+ * Assign a variable, updating the environment too if it is exported.
+ */
+void Executor::assign_variable(string_view name, string_view value)
+{
+    _variables.set(name, value);
+    if (_environment.find(name)) _environment.set(name, value);
 }
 
 /**
- * Divide a CLASH command, which contains only single quotations and the 
- * backslash as an escape character, into words.
+ * Find the executable that a command name refers to, by searching the 
+ * directories of the PATH variable in order (see PathIndex).
  * 
- * Double quotes, variable substitutions, and command substitutions should be
- * processed before this method. The only special characters considered here are
- * single quotations and the backslash, which is used to escape space characters 
- * (so that they do not delimit the current word), I/O redirection operators, 
- * single quotes, and other backslashes.
+ * @param name The command name, which must not contain a '/'.
  * 
- * @param cmd A CLASH command which only contains single quotes and backslashes 
- * as special characters, i.e. one that has been modified by 
- * process_special_syntax().
- * @param words An empty vector, which will be populated with the words.
+ * @return The full path, valid until the next lookup, or nullptr if there is 
+ *         no such executable.
  */
-void Executor::divide_into_words(Command &cmd, vector<string> &words)
+const char* Executor::find_executable(string_view name)
 {
-    cmd.bash_str += ' ';
-    const string &cmd_str = cmd.bash_str;
+    update_path_index();
+    const string *path = _path_index.find(name);
+    if (!path) return nullptr;
+    LOG_F(INFO, "full executable path found: %s", path->c_str());
+    return path->c_str();
+}
 
-    /* PARSING STATE FLAGS */
-    bool backslashed = false;
-    bool single_quoted = false;
-    bool double_quoted = false;
-    bool quoted_word = false;
-    bool i_redirect = false, o_redirect = false;
+/**
+ * Point the PATH index at the current value of PATH, which may have been 
+ * assigned or unset since the last lookup. (Cheap when it hasn't changed.)
+ */
+void Executor::update_path_index()
+{
+    _path_index.set_path(_variables.find("PATH").value_or(kPATH_default));
+}
 
-    /* stores current accumulated word as we scan the command string */
-    string word {};
+/**
+ * Save what the PATH index has learned to the cache file, if there is one, 
+ * for the next clash process to start with.
+ */
+void Executor::save_path_cache()
+{
+    if (_path_cache_file.empty()) return;
+    if (!_path_index.save(_path_cache_file)) {
+        LOG_F(WARNING, "couldn't write PATH cache %s: %s", 
+              _path_cache_file.c_str(), strerror(errno));
+    }
+}
 
-    for (int i = 0; i < cmd_str.length(); i++) {
-        /* QUOTATION ENVIRONMENT */
-        if (single_quoted || double_quoted) {
-            if ((single_quoted && cmd_str[i] == '\'') || 
-                (double_quoted && cmd_str[i] == '"')) {
-                single_quoted = false;
-                double_quoted = false;
-            }
-            else word += cmd_str[i];
+/**
+ * Expand a word into zero or more fields, performing variable and command
+ * substitution.
+ * 
+ * The results of unquoted substitutions are split into separate fields on
+ * spaces, tabs, and newlines; quoted parts and literal text are never split.
+ * A word containing quotes always produces at least one (possibly empty)
+ * field. Fields are null-terminated copies in the command arena.
+ * 
+ * @param word The parsed word to be expanded.
+ * @param fields Output parameter to which the resulting fields are appended.
+ */
+void Executor::expand_word(const ast::Word &word, Words &fields)
+{
+    /* CASE: plain word, nothing to expand */
+    if (word.parts.size() == 1 && 
+        word.parts[0].kind == ast::WordPart::Kind::Literal) {
+        fields.push_back(_arena.copy(word.parts[0].text));
+        return;
+    }
+
+    string field;
+    /* set once the current field must be produced, even if empty */
+    bool have_field = false;
+
+    for (const ast::WordPart &part : word.parts) {
+        if (part.kind == ast::WordPart::Kind::Literal || part.quoted) {
+            field += expand_part(part);
+            have_field = have_field || part.quoted || !part.text.empty();
             continue;
         }
 
-        switch (cmd_str[i])
-        {
-            /* SPECIAL SYNTAX */
-            case '\\':
-                if (backslashed) word += '\\';
-                backslashed = !backslashed;
-                continue;
-            case '\'':
-            case '"':
-                if (backslashed) {
-                    word += cmd_str[i];
-                    backslashed = false;
-                    continue;
-                }
-                else {
-                    quoted_word = true;
-                    single_quoted = cmd_str[i] == '\'';
-                    double_quoted = cmd_str[i] == '"';
-                }
-                continue;
-            /* WORD SEPARATORS */
-            case '<':
-            case '>':
-            case ' ':
-            case '\t':
-                if (backslashed) {
-                    word += cmd_str[i];
-                    backslashed = false;
-                    continue;
-                }
+        /* unquoted substitution: split on blanks */
+        for (char c : expand_part(part)) {
+            if (c == ' ' || c == '\t' || c == '\n') {
+                if (have_field) fields.push_back(_arena.copy(field));
+                field.clear();
+                have_field = false;
+            }
+            else {
+                field += c;
+                have_field = true;
+            }
+        }
+    }
 
-                /* CASE: a nonempty word has accumulated upon encountering a 
-                 * word separator, or an empty word must be counted because it
-                 * appears within quotes; process this word */
-                if (!word.empty() || quoted_word) {
-                    if (i_redirect) {
-                        cmd.redirect_input(word);
-                        i_redirect = false;
-
-                    }
-                    else if (o_redirect) {
-                        cmd.redirect_output(word);
-                        o_redirect = false;
-                    }
-                    else words.push_back(word);
-                    word.clear();
-                }
-                /* CASE: two I/O redirection operators appear in a row */
-                else if ((i_redirect || o_redirect) && 
-                         (cmd_str[i] == '<' || cmd_str[i] == '>')) {
-                    throw ExecutorException("missing redirection file name");
-                }
+    if (have_field) fields.push_back(_arena.copy(field));
+}
 
-                quoted_word = false;
-                if (cmd_str[i] == '<') i_redirect = true;
-                if (cmd_str[i] == '>') o_redirect = true;
+/**
+ * Expand a word into a single string, without word splitting. Used for 
+ * variable assignments and redirection file names.
+ * 
+ * @return A null-terminated view into the command arena.
+ */
+string_view Executor::expand_word_to_string(const ast::Word &word)
+{
+    if (word.parts.size() == 1 && 
+        word.parts[0].kind == ast::WordPart::Kind::Literal) {
+        return _arena.copy(word.parts[0].text);
+    }
+
+    string result;
+    for (const ast::WordPart &part : word.parts) result += expand_part(part);
+    return _arena.copy(result);
+}
 
-                continue;
-            default:
-                backslashed = false;
-                word += cmd_str[i];
-                continue;
+/**
+ * Returns the value of a single part of a word: literal text, the value of a
+ * variable, the output of a command substitution (minus trailing 
+ * newlines), or the result of an arithmetic expression.
+ * 
+ * The returned view is only valid until the next expansion.
+ */
+string_view Executor::expand_part(const ast::WordPart &part)
+{
+    switch (part.kind) {
+        case ast::WordPart::Kind::Literal:
+            return part.text;
+        case ast::WordPart::Kind::Variable:
+            if (part.op) return expand_parameter(part);
+            return lookup_variable(part.text);
+        case ast::WordPart::Kind::CommandSub: {
+            // use the output if it was already run in parallel; otherwise
+            // run the subcommand now. Either way the output stays in its 
+            // buffer until the arena is reset.
+            string_view result;
+            auto prefetched = std::find_if(
+                _substitution_outputs.begin(), _substitution_outputs.end(),
+                [&](const auto &output) { return output.first == &part; });
+            if (prefetched != _substitution_outputs.end()) {
+                result = prefetched->second;
+            }
+            else {
+                _captures.push_back(std::make_unique<CaptureBuffer>(
+                    _options.capture_spill_threshold));
+                // (nested substitutions add their own buffers meanwhile)
+                CaptureBuffer &buffer = *_captures.back();
+                capture_output(string(part.text), buffer);
+                result = buffer.view();
+            }
+            // remove trailing newlines
+            while (!result.empty() && result.back() == '\n') {
+                result.remove_suffix(1);
+            }
+            return result;
+        }
+        case ast::WordPart::Kind::Arithmetic: {
+            int64_t value = evaluate_arithmetic(part.text);
+            char *text = static_cast<char *>(_arena.allocate(24, 1));
+            auto result = std::to_chars(text, text + 24, value);
+            return string_view(text, result.ptr - text);
         }
     }
+    return {};
+}
 
-    if (i_redirect) {
-        throw ExecutorException("missing input file name");
+/**
+ * Returns the value of a parameter expansion with an operator, such as 
+ * '${name%pattern}', in the command arena.
+ * 
+ * @throws ExecutorException for an invalid substring length.
+ */
+string_view Executor::expand_parameter(const ast::WordPart &part)
+{
+    using Kind = ast::ParameterOp::Kind;
+    const ast::ParameterOp &op = *part.op;
+    // copied, since expanding the operand may change variables
+    string value(lookup_variable(part.text));
+
+    switch (op.kind) {
+        case Kind::Length:
+            return _arena.copy(std::to_string(value.size()));
+        case Kind::Default:
+            if (!value.empty()) return _arena.copy(value);
+            return expand_word_to_string(op.operand);
+        case Kind::Substring: {
+            int64_t size = value.size();
+            int64_t offset = evaluate_arithmetic(op.offset);
+            if (offset < 0) offset += size;
+            if (offset < 0 || offset > size) return "";
+            int64_t end = size;
+            if (op.has_length) {
+                int64_t length = evaluate_arithmetic(op.length);
+                end = length < 0 ? size + length : std::min(offset + length, 
+                                                            size);
+                if (end < offset) {
+                    throw ExecutorException(string(part.text) + 
+                                            ": substring expression < 0");
+                }
+            }
+            return _arena.copy(string_view(value).substr(offset, 
+                                                         end - offset));
+        }
+        default:
+            break;
     }
-    if (o_redirect) {
-        throw ExecutorException("missing output file name");
+
+    /* pattern operators */
+    std::optional<GlobPattern> expanded_pattern;
+    if (!op.pattern) expanded_pattern.emplace(expand_pattern(op.operand));
+    const GlobPattern &pattern = op.pattern ? *op.pattern : *expanded_pattern;
+    string_view text = value;
+    size_t pos;
+    switch (op.kind) {
+        case Kind::RemovePrefix:
+            pos = pattern.match_prefix(text, op.doubled);
+            if (pos != string_view::npos) text.remove_prefix(pos);
+            return _arena.copy(text);
+        case Kind::RemoveSuffix:
+            pos = pattern.match_suffix(text, op.doubled);
+            if (pos != string_view::npos) text = text.substr(0, pos);
+            return _arena.copy(text);
+        default: {
+            string_view replacement = expand_word_to_string(op.replacement);
+            if (op.anchor == '#') {
+                pos = pattern.match_prefix(text, true);
+                if (pos == string_view::npos) return _arena.copy(text);
+                return _arena.concat(replacement, text.substr(pos));
+            }
+            if (op.anchor == '%') {
+                pos = pattern.match_suffix(text, true);
+                if (pos == string_view::npos) return _arena.copy(text);
+                return _arena.concat(text.substr(0, pos), replacement);
+            }
+            string result;
+            size_t from = 0, length;
+            while (pattern.find(text, from, pos, length)) {
+                result.append(text, from, pos - from).append(replacement);
+                from = pos + length;
+                if (!op.doubled) break;
+            }
+            result.append(text.substr(from));
+            return _arena.copy(result);
+        }
     }
 }
 
+/**
+ * Expand a word into a glob pattern: the text of quoted parts is escaped, so
+ * that only unquoted text and substitutions can contain wildcards.
+ */
+string Executor::expand_pattern(const ast::Word &word)
+{
+    string pattern;
+    for (const ast::WordPart &part : word.parts) {
+        string_view text = expand_part(part);
+        pattern += part.quoted ? GlobPattern::escape(text) : string(text);
+    }
+    return pattern;
+}
+
+/**
+ * Evaluate an arithmetic expression (see Arithmetic) against the shell's 
+ * variables.
+ */
+int64_t Executor::evaluate_arithmetic(string_view expression)
+{
+    Arithmetic::Lookup lookup = [this](string_view name) {
+        return lookup_variable(name);
+    };
+    Arithmetic::Assign assign = [this](string_view name, int64_t value) {
+        char text[24];
+        auto result = std::to_chars(text, text + sizeof(text), value);
+        assign_variable(name, string_view(text, result.ptr - text));
+    };
+    return Arithmetic(expression, lookup, assign).evaluate();
+}
+
+
+/**
+ * Close the command's input and output, unless they are standard input or 
+ * the shell's output.
+ */
+Executor::Command::~Command()
+{
+    if (input_fd != STDIN_FILENO) close(input_fd);
+    if (output_fd != default_output_fd) close(output_fd);
+}
 
 /**
  * Open a file and redirect the input of the command to its file descriptor.
@@ -692,12 +1625,13 @@ void Executor::divide_into_words(Command &cmd, vector<string> &words)
  * 
  * @throws error If file does not exist
  */
-void Executor::Command::redirect_input(const std::string &fname)
+void Executor::Command::redirect_input(const char *fname)
 {
-    int fd = open(fname.c_str(), O_RDONLY, 0644);
+    int fd = open(fname, O_RDONLY | O_CLOEXEC, 0644);
     if (fd == -1) {
         throw ExecutorException(strerror(errno));
     }
+    if (input_fd != STDIN_FILENO) close(input_fd);
     input_fd = fd;
 }
 
@@ -709,61 +1643,14 @@ void Executor::Command::redirect_input(const std::string &fname)
  * 
  * @throws error If file is unable to be opened or created. 
  */
-void Executor::Command::redirect_output(const std::string &fname)
+void Executor::Command::redirect_output(const char *fname)
 {
-    int fd = open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644); 
+    int fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 
+                  0644); 
     if (fd == -1) {
         throw ExecutorException(strerror(errno));
     }
+    if (output_fd != default_output_fd) close(output_fd);
     output_fd = fd;
+    output_is_pipe = false;
 }
-
-
-
-
-
-/**
- * Checks if the input string conforms to valid clash variable formatting. 
- * Rules:
- *  1. initial character is a letter followed by any number of letters or digits
- *  2. followed by a '='
- *  3. the rest is the variable's value, and has no format requirements
- */
- bool is_properly_formatted_var(const string& input) {
-     if (input.size() < 2) return false;
-
-     if (isalpha(input[0]) == 0) return false;
-
-    int eq_idx = input.find('=');
-    if (eq_idx == string::npos) return false;
-
-    auto last = input.begin() + eq_idx;
-    return last == find_if_not(input.begin() + 1, last, 
-                               [](unsigned char c){ return std::isalnum(c); });
- } 
-
-
-/** 
- * Utility function. Parses and returns each path in PATH. 
- *
- * Note: the current directory '.' is always additionally included.
- */ 
- std::unordered_set<std::string> extract_paths_from_PATH() {
-    char *path_ptr = getenv("PATH");
-    string PATH = path_ptr ? string(path_ptr) : kPATH_default;
-    LOG_F(INFO, "existing PATH variable was %s", 
-          (path_ptr ? "found" : "not found"));
-    int start_idx = 0;
-
-    std::unordered_set<std::string> result;
-    while(start_idx < PATH.length()) {
-        int delim_idx = PATH.find(':', start_idx);
-        result.insert(PATH.substr(start_idx, delim_idx - start_idx));
-        if (delim_idx == string::npos) break;
-        start_idx = delim_idx + 1;
-    }
-
-    result.insert(".");
-
-    return result;
- }
\ No newline at end of file
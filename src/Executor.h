@@ -1,7 +1,18 @@
 #include "loguru/loguru.hpp"
+#include "Environment.h"
+#include "ExecutableCache.h"
+#include "JobTable.h"
+#include "Parser.h"
+#include "PathIndex.h"
+#include "VarStore.h"
+#include "util/arena.h"
+#include "util/capture_buffer.h"
+#include "util/lru_cache.h"
 #include <unistd.h> // for STDIN_FILENO, STDOUT_FILENO
+#include <memory>
+#include <optional>
+#include <string_view>
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
 #include <string>
 
@@ -23,31 +34,250 @@ class Executor {
   public:
     Executor(const std::vector<std::string>& argv = {});
     ~Executor();
-    void execute_command(std::string input);
-    std::string execute_command_and_capture_output(std::string input);
+    void execute_command(const std::string& input);
+    std::string execute_command_and_capture_output(const std::string& input);
+    /* parse a command without executing it, throwing what execute_command
+       would for a syntax error or incomplete input */
+    void check_syntax(const std::string& input) { parse(input); }
+    /* the exit status of the last command ($?) */
+    int status() const { return _variables.status(); }
+    void set_status(int status) { _variables.set_status(status); }
+
+    /* tunable settings; may be changed between commands */
+    struct Options {
+        /* number of distinct input lines whose parse trees are kept */
+        size_t parse_cache_capacity = 256;
+        /* start executables with posix_spawn rather than fork + exec */
+        bool posix_spawn = true;
+        /* start recently used executables from cached O_PATH descriptors 
+           with vfork + execveat (Linux only) */
+        bool execveat = true;
+        /* number of executables whose descriptors are kept open */
+        size_t exec_fd_cache_capacity = 64;
+        /* run utilities like 'echo' and 'test' as builtins rather than 
+           executables */
+        bool builtin_utils = true;
+        /* command substitution output beyond this many bytes is moved from
+           the heap into an in-memory file */
+        size_t capture_spill_threshold = 64 << 20;
+        /* run the command substitutions of a command concurrently, each in
+           its own subshell (even a lone one, so their side effects never
+           survive). Off, they run one at a time inside the shell, so that
+           each can see the side effects (variable assignments, cd) of the
+           ones before it, and the shell sees them afterwards. */
+        bool parallel_substitutions = true;
+        /* the most background jobs that run at once ($CLASH_MAX_JOBS); a
+           job started when all are busy waits for one to finish. 0: the
+           number of online CPUs */
+        size_t max_jobs = 0;
+        /* under 'make -j', run each background job beyond the first on a
+           token from make's jobserver, so as not to exceed make's limit */
+        bool jobserver = true;
+        /* the status of a pipeline is that of its last stage that failed,
+           or 0 if none did (rather than that of its last stage) */
+        bool pipefail = false;
+    };
+    Options& options() { return _options; }
+
+    /* counters for tuning the caches above */
+    struct Stats {
+        size_t parse_cache_hits = 0;
+        size_t parse_cache_misses = 0;
+        /* command lookups answered by a remembered PATH search */
+        size_t path_hits = 0;
+        /* lookups of commands already known not to be in PATH */
+        size_t path_negative_hits = 0;
+        /* PATH directories read into the index */
+        size_t path_directory_reads = 0;
+    };
+    const Stats& stats();
 
   private:
+    /* expanded words: null-terminated views into the command arena */
+    using Words = 
+        std::vector<std::string_view, ArenaAllocator<std::string_view>>;
+
+    /* a simple command after expansion, ready to be executed. Owns any
+       input/output file descriptors other than standard input and the
+       shell's current output, closing them when destroyed. */
     struct Command {
-        Command(std::string cmd) 
-          : bash_str(cmd), input_fd(STDIN_FILENO), output_fd(STDOUT_FILENO) {}
-        void redirect_input(const std::string &fname);
-        void redirect_output(const std::string &fname);
+        Command(Arena &arena, int default_output_fd) 
+          : words(arena), assignments(arena), input_fd(STDIN_FILENO), 
+            output_fd(default_output_fd),
+            default_output_fd(default_output_fd) {}
+        ~Command();
+        Command(const Command&) = delete;
+        Command& operator=(const Command&) = delete;
+        void redirect_input(const char *fname);
+        void redirect_output(const char *fname);
 
-        std::string bash_str;
+        Words words;
+        /* prefix assignments for the command's environment, as 
+           null-terminated "NAME=value" views into the command arena */
+        Words assignments;
         int input_fd;
         int output_fd;
+        /* where output goes unless redirected; not owned */
+        const int default_output_fd;
+        /* true if the command runs concurrently with the shell (as a 
+           pipeline stage, or in the background), which then doesn't wait 
+           for it */
         bool is_part_of_pipeline = false;
+        /* true if the command is (part of) a background job: it must not 
+           run inside the shell at all */
+        bool in_background = false;
+        /* true if output_fd is a pipe to the next command of a pipeline */
+        bool output_is_pipe = false;
     };
 
-    std::unordered_map<std::string, std::string> _var_bindings;
-    std::unordered_map<std::string, std::string> _cached_command_paths;
-    std::unordered_set<std::string> _PATHs;
+    /* a command implemented inside the shell (see Builtins.cpp). Builtins
+       return their exit status, and throw ExecutorExceptions for errors that
+       should abort the rest of the line. */
+    struct Builtin {
+        /* Special builtins change or report the state of the shell. Utility
+           builtins stand in for executables of the same name, and are
+           skipped when the 'builtin_utils' option is off. Regular builtins
+           are neither: they have no executable to fall back on. */
+        enum class Kind { Special, Regular, Utility };
 
-    void divide_into_commands(std::string input, 
-                              std::vector<Command> &commands);
-    void eval_command(Command &cmd, std::vector<pid_t>& pipeline_pids);
-    std::string process_special_syntax(const std::string &cmd);
-    void divide_into_words(Command &cmd, std::vector<std::string> &words);
+        int (Executor::*fn)(Command &cmd);
+        Kind kind;
+    };
+    static const std::unordered_map<std::string_view, Builtin> kBuiltins;
+
+    /* a shell function: its body, and the parse tree that holds it */
+    struct Function {
+        std::shared_ptr<const ast::CommandList> tree;
+        const ast::CompoundCommand *body;
+        /* those of the definition, 'name() { ...; } > file' */
+        const std::vector<ast::Redirection> *redirections;
+    };
+
+    /* a variable as it was before a prefix assignment ('X=1 f') */
+    struct SavedVariable {
+        std::string name;
+        std::optional<std::string> value;
+        std::optional<std::string> exported;
+    };
+
+    VarStore _variables;
+    /* the exported variables, passed to executables */
+    Environment _environment;
+    PathIndex _path_index;
+    /* where the PATH index is persisted between runs ($CLASH_PATH_CACHE), 
+       or empty */
+    std::string _path_cache_file;
+
+    Options _options;
+    Stats _stats;
+    /* descriptors of recently launched executables */
+    ExecutableCache _executables {_options.exec_fd_cache_capacity};
+    /* parse trees of recently executed input lines, keyed by the raw line */
+    LRUCache<std::string_view, std::shared_ptr<const ast::CommandList>> 
+        _parse_cache {_options.parse_cache_capacity};
+    /* the parse tree being executed */
+    std::shared_ptr<const ast::CommandList> _current_list;
+    /* keyed by name, a view into the function's own tree */
+    std::unordered_map<std::string_view, Function> _functions;
+    /* commands run with '&' */
+    JobTable _jobs;
+    /* scratch memory for expanding and launching commands; reset after each
+       top-level command (see release_scratch) */
+    Arena _arena;
+    /* output of the command substitutions expanded so far; released along
+       with the arena */
+    std::vector<std::unique_ptr<CaptureBuffer>> _captures;
+    /* outputs of the substitutions of the command being expanded that were
+       already run concurrently (see run_substitutions_in_parallel) */
+    std::vector<std::pair<const ast::WordPart*, std::string_view>> 
+        _substitution_outputs;
+    int _execution_depth = 0;
+    /* set by 'break', 'continue', and 'return' until the loop or function
+       they apply to sees it; sequences stop executing commands meanwhile */
+    enum class Control { None, Break, Continue, Return };
+    Control _control = Control::None;
+    /* the number of loops still to be ended by _control */
+    int _control_levels = 0;
+    /* the number of loops currently executing (in the innermost function
+       call) */
+    int _loop_depth = 0;
+    /* the number of function calls in progress */
+    int _function_depth = 0;
+    /* where commands write unless redirected: standard output, or the pipe
+       of the command substitution being captured */
+    int _output_fd = STDOUT_FILENO;
+
+    std::shared_ptr<const ast::CommandList> parse(std::string_view input);
+    void capture_output(const std::string& input, CaptureBuffer& buffer);
+    void run_substitutions_in_parallel(const ast::SimpleCommand &node);
+    void release_scratch();
+    void execute_sequence(const ast::Sequence &sequence);
+    void execute_and_or(const ast::AndOr &and_or);
+    void start_job(const ast::AndOr &and_or);
+    size_t job_limit() const;
+    void launch_job(const ast::AndOr &and_or, std::vector<pid_t> &pids,
+                    bool &negated);
+    void execute_pipeline(const ast::Pipeline &pipeline);
+    void launch_pipeline(const ast::Pipeline &pipeline, 
+                         std::vector<pid_t>& pipeline_pids, bool background,
+                         std::vector<int> *stage_statuses = nullptr);
+    void wait_for_stages(const std::vector<pid_t> &pids, 
+                         std::vector<int> &statuses);
+    void finish_pipeline(const ast::Pipeline &pipeline, 
+                         const int *statuses, size_t n_stages);
+    void execute_compound(const ast::CompoundCommand &compound);
+    void execute_while(const ast::CompoundCommand &loop);
+    void execute_for(const ast::CompoundCommand &loop);
+    void execute_case(const ast::CompoundCommand &compound);
+    bool finish_iteration();
+    void run_compound(const ast::CompoundCommand &compound, Command &cmd,
+                      std::vector<pid_t>& pipeline_pids);
+    void define_function(const ast::Command &command);
+    void call_function(Function function, Command &cmd,
+                       std::vector<pid_t>& pipeline_pids);
+    void eval_command(const ast::SimpleCommand &node, Command &cmd, 
+                      std::vector<pid_t>& pipeline_pids);
+    void apply_redirections(
+        const std::vector<ast::Redirection> &redirections, Command &cmd);
+    std::vector<SavedVariable> assign_temporarily(const Command &cmd);
+    void restore_variables(const std::vector<SavedVariable> &saved);
+    void run_builtin(const Builtin &builtin, Command &cmd, 
+                     std::vector<pid_t>& pipeline_pids);
+    pid_t launch_executable(const Command &cmd, char **argv);
+    pid_t launch_executable_fd(const Command &cmd, int exec_fd, char **argv,
+                               char **envp);
+    std::string_view lookup_variable(std::string_view name);
+    void assign_variable(std::string_view name, std::string_view value);
+    const char* find_executable(std::string_view name);
+    void update_path_index();
+    void save_path_cache();
+    void expand_word(const ast::Word &word, Words &fields);
+    std::string_view expand_word_to_string(const ast::Word &word);
+    std::string_view expand_part(const ast::WordPart &part);
+    std::string_view expand_parameter(const ast::WordPart &part);
+    std::string expand_pattern(const ast::Word &word);
+    int64_t evaluate_arithmetic(std::string_view expression);
+
+    /* builtins */
+    int builtin_cd(Command &cmd);
+    int builtin_exit(Command &cmd);
+    int builtin_export(Command &cmd);
+    int builtin_unset(Command &cmd);
+    int builtin_set(Command &cmd);
+    int builtin_hash(Command &cmd);
+    int builtin_echo(Command &cmd);
+    int builtin_printf(Command &cmd);
+    int builtin_true(Command &cmd);
+    int builtin_false(Command &cmd);
+    int builtin_test(Command &cmd);
+    int builtin_sleep(Command &cmd);
+    int builtin_break(Command &cmd);
+    int builtin_continue(Command &cmd);
+    int loop_control(Command &cmd, Control control);
+    int builtin_return(Command &cmd);
+    int builtin_jobs(Command &cmd);
+    int builtin_wait(Command &cmd);
+    int builtin_parallel(Command &cmd);
 
 
   public: 
@@ -63,4 +293,11 @@ class Executor {
                 return _msg.c_str();
             } 
         };
+
+    /* thrown for input that ends in the middle of a command (e.g. an 'if' 
+       without its 'fi'), which more input could complete */
+    class IncompleteInputException: public ExecutorException {
+        public:
+            using ExecutorException::ExecutorException;
+    };
 };
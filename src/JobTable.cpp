@@ -0,0 +1,285 @@
+#include "JobTable.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#endif
+
+using std::string;
+using std::string_view;
+using std::vector;
+
+int JobTable::exit_status(int wait_status)
+{
+    return WIFSIGNALED(wait_status) ? 128 + WTERMSIG(wait_status)
+                                    : WEXITSTATUS(wait_status);
+}
+
+JobTable::JobTable() : _owner(getpid()), _jobserver(getenv("MAKEFLAGS")) {}
+
+JobTable::~JobTable()
+{
+    for (const auto &entry : _pidfds) {
+        if (entry.second != -1) close(entry.second);
+    }
+    if (_epoll_fd != -1) close(_epoll_fd);
+}
+
+/**
+ * Drop everything inherited from the parent, in a forked child. The epoll
+ * instance is shared with the parent, so the inherited descriptors are only
+ * closed, never removed from it.
+ */
+void JobTable::forget_if_forked()
+{
+    if (_owner == getpid()) return;
+    for (const auto &entry : _pidfds) {
+        if (entry.second != -1) close(entry.second);
+    }
+    _pidfds.clear();
+    _jobs.clear();
+    if (_epoll_fd != -1) close(_epoll_fd);
+    _epoll_fd = -1;
+    _owner = getpid();
+}
+
+int JobTable::add(vector<pid_t> pids, string_view text, bool negated,
+                  bool holds_token)
+{
+    forget_if_forked();
+    Job job {_jobs.empty() ? 1 : _jobs.back().id + 1, string(text),
+             std::move(pids), 0};
+    job.n_running = job.pids.size();
+    job.negated = negated;
+    job.holds_token = holds_token && job.n_running > 0;
+    if (holds_token && !job.holds_token) _jobserver.release();
+
+    for (pid_t pid : job.pids) {
+        int pidfd = -1;
+#if defined(__linux__) && defined(SYS_pidfd_open)
+        if (_epoll_fd == -1) _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (_epoll_fd != -1) {
+            // pidfds are always close-on-exec
+            pidfd = syscall(SYS_pidfd_open, pid, 0);
+            struct epoll_event event {};
+            event.events = EPOLLIN;
+            event.data.u64 = pid;
+            if (pidfd != -1 &&
+                epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, pidfd, &event) == -1) {
+                close(pidfd);
+                pidfd = -1;
+            }
+        }
+#endif
+        _pidfds[pid] = pidfd;
+    }
+    _jobs.push_back(std::move(job));
+    return _jobs.back().id;
+}
+
+bool JobTable::empty()
+{
+    if (_jobs.empty()) return true;
+    forget_if_forked();
+    return _jobs.empty();
+}
+
+bool JobTable::acquire_slot(size_t max_running, bool use_jobserver)
+{
+    forget_if_forked();
+    use_jobserver = use_jobserver && _jobserver.connected();
+    while (true) {
+        reap();
+        size_t n_running = 0;
+        bool implicit_slot_free = true;
+        for (const Job &job : _jobs) {
+            if (job.n_running == 0) continue;
+            ++n_running;
+            if (!job.holds_token) implicit_slot_free = false;
+        }
+        bool may_run = n_running < max_running;
+        if (may_run) {
+            if (!use_jobserver || implicit_slot_free) return false;
+            if (_jobserver.try_acquire()) return true;
+        }
+        // the jobserver is only watched when a token is all that's missing
+        wait_for_change(may_run ? _jobserver.fd() : -1);
+    }
+}
+
+void JobTable::release_tokens()
+{
+    forget_if_forked();
+    for (Job &job : _jobs) job.holds_token = false;
+    _jobserver.release_all();
+}
+
+/**
+ * Sleep until a process may have exited, or 'extra_fd' (if not -1) has
+ * become readable. Processes without pidfds are polled every 10ms.
+ */
+void JobTable::wait_for_change(int extra_fd)
+{
+    struct pollfd fds[2] = {{_epoll_fd, POLLIN, 0}, {extra_fd, POLLIN, 0}};
+    bool polled = std::any_of(_pidfds.begin(), _pidfds.end(),
+                              [](const auto &entry) {
+                                  return entry.second == -1;
+                              });
+    poll(fds, 2, polled ? 10 : -1);
+}
+
+void JobTable::reap()
+{
+    forget_if_forked();
+    if (_pidfds.empty()) return;
+    collect(0);
+    poll_unwatched();
+}
+
+int JobTable::wait(int id)
+{
+    forget_if_forked();
+    auto job = std::find_if(_jobs.begin(), _jobs.end(),
+                            [&](const Job &job) { return job.id == id; });
+    if (job == _jobs.end()) return 127;
+
+    while (job->n_running > 0) {
+        // a process without a pidfd is waited for directly
+        auto unwatched = std::find_if(job->pids.begin(), job->pids.end(),
+                                      [&](pid_t pid) {
+                                          auto it = _pidfds.find(pid);
+                                          return it != _pidfds.end() &&
+                                                 it->second == -1;
+                                      });
+        if (unwatched == job->pids.end()) {
+            collect(-1);
+            continue;
+        }
+        int wait_status = 0;
+        if (waitpid(*unwatched, &wait_status, 0) == -1 && errno == EINTR) {
+            continue;
+        }
+        finish(*unwatched, wait_status);
+    }
+
+    int status = job->negated ? job->status == 0 : job->status;
+    _jobs.erase(job);
+    return status;
+}
+
+const JobTable::Job* JobTable::find(int id)
+{
+    forget_if_forked();
+    for (const Job &job : _jobs) {
+        if (job.id == id) return &job;
+    }
+    return nullptr;
+}
+
+const JobTable::Job* JobTable::find_pid(pid_t pid)
+{
+    forget_if_forked();
+    for (const Job &job : _jobs) {
+        if (std::find(job.pids.begin(), job.pids.end(), pid) !=
+            job.pids.end()) {
+            return &job;
+        }
+    }
+    return nullptr;
+}
+
+const vector<JobTable::Job>& JobTable::jobs()
+{
+    forget_if_forked();
+    return _jobs;
+}
+
+void JobTable::mark_reported()
+{
+    for (Job &job : _jobs) {
+        if (job.n_running == 0) job.reported = true;
+    }
+}
+
+void JobTable::remove_reported()
+{
+    forget_if_forked();
+    _jobs.erase(std::remove_if(_jobs.begin(), _jobs.end(),
+                               [](const Job &job) { return job.reported; }),
+                _jobs.end());
+}
+
+/**
+ * Collect the processes whose pidfds report that they have exited, waiting
+ * up to 'timeout_ms' (-1: indefinitely) for the first one.
+ *
+ * @return 'false' if nothing was collected.
+ */
+bool JobTable::collect(int timeout_ms)
+{
+#ifdef __linux__
+    if (_epoll_fd == -1) return false;
+    struct epoll_event events[16];
+    int n_events = epoll_wait(_epoll_fd, events, 16, timeout_ms);
+    for (int i = 0; i < n_events; ++i) {
+        pid_t pid = static_cast<pid_t>(events[i].data.u64);
+        int wait_status = 0;
+        if (waitpid(pid, &wait_status, WNOHANG) == 0) continue;
+        finish(pid, wait_status);
+    }
+    return n_events > 0;
+#else
+    (void) timeout_ms;
+    return false;
+#endif
+}
+
+/** Collect the processes without pidfds that have exited. */
+void JobTable::poll_unwatched()
+{
+    vector<pid_t> exited;
+    vector<int> statuses;
+    for (const auto &entry : _pidfds) {
+        int wait_status = 0;
+        if (entry.second == -1 &&
+            waitpid(entry.first, &wait_status, WNOHANG) != 0) {
+            exited.push_back(entry.first);
+            statuses.push_back(wait_status);
+        }
+    }
+    for (size_t i = 0; i < exited.size(); ++i) finish(exited[i], statuses[i]);
+}
+
+/**
+ * Record that a process has exited; the last process of a job sets its
+ * status.
+ */
+void JobTable::finish(pid_t pid, int wait_status)
+{
+    auto entry = _pidfds.find(pid);
+    if (entry == _pidfds.end()) return;
+#ifdef __linux__
+    if (entry->second != -1) {
+        epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, entry->second, nullptr);
+        close(entry->second);
+    }
+#endif
+    _pidfds.erase(entry);
+
+    for (Job &job : _jobs) {
+        auto it = std::find(job.pids.begin(), job.pids.end(), pid);
+        if (it == job.pids.end()) continue;
+        --job.n_running;
+        if (it + 1 == job.pids.end()) job.status = exit_status(wait_status);
+        if (job.n_running == 0 && job.holds_token) {
+            _jobserver.release();
+            job.holds_token = false;
+        }
+        break;
+    }
+}
@@ -0,0 +1,131 @@
+#pragma once
+#include "Jobserver.h"
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * The background jobs of a shell session ('command &'), and the reaping of
+ * their processes.
+ *
+ * On Linux, each process is watched through a pidfd registered with a single
+ * epoll instance. reap() then collects every process that has exited, in the
+ * order they exited, with one non-blocking epoll_wait, and wait() sleeps in
+ * epoll_wait until the job it waits for is done, collecting any others that
+ * finish meanwhile. Where pidfds are unavailable, processes are polled with
+ * waitpid(WNOHANG) instead.
+ *
+ * Nothing else in the shell waits for these processes: foreground commands
+ * only ever wait for their own pids. A finished job stays in the table until
+ * it is waited for, or until it has been reported as finished by 'jobs' and
+ * 'jobs' runs again.
+ *
+ * The table also hands out job slots, which bound how many jobs run at once;
+ * see acquire_slot(). When the shell runs under 'make -j', each job beyond
+ * the first also takes a token from make's jobserver for as long as it runs.
+ *
+ * A forked child of the shell inherits a copy of the table, but not the
+ * processes in it; the first use in the child finds it empty.
+ */
+class JobTable {
+  public:
+    struct Job {
+        /* the job number, %N */
+        int id;
+        /* the command, as written */
+        std::string text;
+        /* the job's status is that of its last process */
+        std::vector<pid_t> pids;
+        size_t n_running;
+        /* decoded: the exit code, or 128 + the number of a fatal signal */
+        int status = 0;
+        /* '!': the status is inverted */
+        bool negated = false;
+        /* listed by 'jobs' after it finished */
+        bool reported = false;
+        /* runs on a jobserver token, returned when it finishes */
+        bool holds_token = false;
+    };
+
+    /** Decode a waitpid() status: the exit code, or 128 + the number of the
+        signal that killed the process. */
+    static int exit_status(int wait_status);
+
+    JobTable();
+    ~JobTable();
+    JobTable(const JobTable&) = delete;
+    JobTable& operator=(const JobTable&) = delete;
+
+    /**
+     * Start tracking a job made of already-started processes.
+     *
+     * @param holds_token Whether it runs on the token acquire_slot() took.
+     * @return The job number: one more than the highest in use.
+     */
+    int add(std::vector<pid_t> pids, std::string_view text, bool negated,
+            bool holds_token = false);
+
+    bool empty();
+
+    /**
+     * Block until another job may start: until fewer than 'max_running' jobs
+     * are running and, when 'use_jobserver' is set and make's jobserver is
+     * available, a token has been taken for the job (unless no other job
+     * runs on make's implicit slot). Jobs that finish meanwhile are
+     * collected. Jobs started while all slots are taken thus queue up, and
+     * start in order as slots free up.
+     *
+     * @return Whether a token was taken: pass it on to add(), or give it
+     *         back with release_token() if the job doesn't start.
+     */
+    bool acquire_slot(size_t max_running, bool use_jobserver);
+    void release_token() { _jobserver.release(); }
+
+    /** Return the jobserver tokens of all jobs, before the shell exits
+        while some are still running. */
+    void release_tokens();
+
+    /** Record the status of every process that has exited, without
+        blocking. */
+    void reap();
+
+    /**
+     * Block until a job has finished, then remove it.
+     *
+     * @return Its status.
+     */
+    int wait(int id);
+
+    /** Returns the job with number 'id', or with a process 'pid'; or
+        nullptr. */
+    const Job* find(int id);
+    const Job* find_pid(pid_t pid);
+
+    /** The jobs, in order of their numbers. */
+    const std::vector<Job>& jobs();
+
+    /** Mark the jobs that have finished as reported. */
+    void mark_reported();
+
+    /** Forget the finished jobs that have been reported. */
+    void remove_reported();
+
+  private:
+    std::vector<Job> _jobs;
+    /* -1 if there is none (e.g. not Linux) */
+    int _epoll_fd = -1;
+    /* the pidfd of each running process, or -1 for polled processes */
+    std::unordered_map<pid_t, int> _pidfds;
+    /* the process the table belongs to */
+    pid_t _owner;
+    /* make's, from $MAKEFLAGS */
+    Jobserver _jobserver;
+
+    void forget_if_forked();
+    void wait_for_change(int extra_fd);
+    bool collect(int timeout_ms);
+    void poll_unwatched();
+    void finish(pid_t pid, int wait_status);
+};
@@ -0,0 +1,123 @@
+#include "Jobserver.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string_view>
+#include <unistd.h>
+
+using std::string;
+using std::string_view;
+
+/**
+ * Returns the value of the last '--NAME=' option in 'makeflags' (later ones
+ * override earlier ones), or "" if there is none.
+ */
+static string_view find_option(string_view makeflags, string_view name)
+{
+    string_view value;
+    for (size_t pos = makeflags.find(name); pos != string_view::npos;
+         pos = makeflags.find(name, pos + 1)) {
+        size_t start = pos + name.size();
+        size_t end = makeflags.find(' ', start);
+        if (end == string_view::npos) end = makeflags.size();
+        value = makeflags.substr(start, end - start);
+    }
+    return value;
+}
+
+/** Returns a new non-blocking, close-on-exec descriptor for 'fd's pipe. */
+static int reopen_nonblocking(int fd)
+{
+    // a new open file description, whose flags are ours alone
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    int new_fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (new_fd != -1) return new_fd;
+    return fcntl(fd, F_DUPFD_CLOEXEC, 0);
+}
+
+Jobserver::Jobserver(const char *makeflags) : _owner(getpid())
+{
+    if (!makeflags) return;
+    string_view auth = find_option(makeflags, "--jobserver-auth=");
+    if (auth.empty()) auth = find_option(makeflags, "--jobserver-fds=");
+    if (auth.empty()) return;
+
+    if (auth.substr(0, 5) == "fifo:") {
+        string path(auth.substr(5));
+        _read_fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        // the fifo has a reader (us), so this doesn't block
+        if (_read_fd != -1) {
+            _write_fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+        }
+    }
+    else {
+        int read_fd, write_fd;
+        if (sscanf(string(auth).c_str(), "%d,%d", &read_fd, &write_fd) != 2 ||
+            read_fd < 0 || write_fd < 0) {
+            return;
+        }
+        // make doesn't pass the descriptors to commands it doesn't consider
+        // recursive; then they are closed (or something else)
+        if (fcntl(read_fd, F_GETFD) == -1 || fcntl(write_fd, F_GETFD) == -1) {
+            return;
+        }
+        _read_fd = reopen_nonblocking(read_fd);
+        if (_read_fd != -1) {
+            _write_fd = fcntl(write_fd, F_DUPFD_CLOEXEC, 0);
+        }
+    }
+    if (_write_fd == -1) close_fds();
+}
+
+Jobserver::~Jobserver()
+{
+    release_all();
+    close_fds();
+}
+
+/** Drop the parent's tokens, in a forked child: they are the parent's to
+    return. */
+void Jobserver::forget_if_forked()
+{
+    if (_owner == getpid()) return;
+    _tokens.clear();
+    _owner = getpid();
+}
+
+void Jobserver::close_fds()
+{
+    if (_read_fd != -1) close(_read_fd);
+    if (_write_fd != -1) close(_write_fd);
+    _read_fd = _write_fd = -1;
+}
+
+bool Jobserver::try_acquire()
+{
+    if (!connected()) return false;
+    forget_if_forked();
+    char token;
+    ssize_t n_read;
+    do {
+        n_read = read(_read_fd, &token, 1);
+    } while (n_read == -1 && errno == EINTR);
+    if (n_read != 1) return false;
+    _tokens += token;
+    return true;
+}
+
+void Jobserver::release()
+{
+    forget_if_forked();
+    if (_tokens.empty()) return;
+    char token = _tokens.back();
+    _tokens.pop_back();
+    while (write(_write_fd, &token, 1) == -1 && errno == EINTR) {}
+}
+
+void Jobserver::release_all()
+{
+    forget_if_forked();
+    while (!_tokens.empty()) release();
+}
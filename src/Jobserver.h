@@ -0,0 +1,55 @@
+#pragma once
+#include <string>
+#include <sys/types.h>
+
+/**
+ * A client of GNU make's jobserver, through which make shares its -j limit
+ * with the commands it runs: a pipe (or, since make 4.4, a named fifo)
+ * holding one byte per free job slot. A command already holds one implicit
+ * slot; to run each additional job at the same time it reads a byte (a
+ * token), and writes the same byte back once that job has finished.
+ *
+ * The jobserver is found in $MAKEFLAGS: '--jobserver-auth=R,W' (or the older
+ * '--jobserver-fds=R,W') for inherited pipe descriptors, or
+ * '--jobserver-auth=fifo:PATH'. Tokens are read from a non-blocking
+ * descriptor of our own, so that taking one never blocks, and never changes
+ * the flags of the descriptors shared with make.
+ *
+ * Tokens still held when the Jobserver is destroyed are returned, so make
+ * never loses any; a shell that exits with exit() (which skips destructors)
+ * returns them with release_all() first. A forked child doesn't inherit the
+ * tokens of its parent.
+ */
+class Jobserver {
+  public:
+    /** Connect to the jobserver in 'makeflags' (may be null), if any. */
+    Jobserver(const char *makeflags);
+    ~Jobserver();
+    Jobserver(const Jobserver&) = delete;
+    Jobserver& operator=(const Jobserver&) = delete;
+
+    bool connected() const { return _read_fd != -1; }
+
+    /** Take a token if one is free, without blocking. */
+    bool try_acquire();
+
+    /** Return a token taken with try_acquire(). */
+    void release();
+
+    /** Return every token held. */
+    void release_all();
+
+    /** A descriptor that becomes readable when a token may be free. */
+    int fd() const { return _read_fd; }
+
+  private:
+    int _read_fd = -1;
+    int _write_fd = -1;
+    /* the tokens held, to be written back as read */
+    std::string _tokens;
+    /* the process the tokens belong to */
+    pid_t _owner;
+
+    void close_fds();
+    void forget_if_forked();
+};
@@ -0,0 +1,989 @@
+#include "Parser.h"
+#include "Executor.h"
+#include "util/char_scan.h"
+#include <algorithm>
+#include <cctype>
+
+using std::string;
+using std::string_view;
+using namespace ast;
+
+/* characters that end a run of ordinary characters */
+static const CharScanner kWordSpecialChars(" \t;\n|&()<>\\'\"$`");
+static const CharScanner kDoubleQuotedSpecialChars("\"\\$`");
+/* characters that end a keyword */
+static const string_view kDelimiters = " \t\n;|&()<>";
+/* words that are keywords when they begin a command */
+static const string_view kKeywords[] = {
+    "if", "then", "elif", "else", "fi", "while", "until", "do", "done", "for",
+    "case", "esac", "{", "}", "!",
+};
+
+/* character classes of names; the <cctype> functions take unsigned chars,
+   and script text holds bytes >= 0x80 (UTF-8) */
+static bool is_digit(char c)
+{
+    return std::isdigit(static_cast<unsigned char>(c));
+}
+static bool is_name_start(char c)
+{
+    return std::isalpha(static_cast<unsigned char>(c)) || c == '_';
+}
+static bool is_name_char(char c)
+{
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+static bool is_assignment(const Word& word);
+static Assignment to_assignment(Word& word);
+static std::optional<GlobPattern> compile_pattern(const Word& word);
+
+/**
+ * Parse the entire source into the command list's body.
+ */
+void Parser::parse()
+{
+    _list.body = parse_sequence({});
+}
+
+/**
+ * Returns the character 'ahead' positions past the current one, or '\0' if
+ * that is past the end of the input.
+ */
+char Parser::peek(size_t ahead) const
+{
+    return _pos + ahead < _input.length() ? _input[_pos + ahead] : '\0';
+}
+
+/** Advance past any spaces and tabs. */
+void Parser::skip_blanks()
+{
+    while (!at_end() && (peek() == ' ' || peek() == '\t')) ++_pos;
+}
+
+/**
+ * Returns the keyword at the current position, or "" if there is none. Only
+ * words at the beginning of a command are keywords; it is up to the caller
+ * to only ask there.
+ */
+string_view Parser::peek_keyword() const
+{
+    size_t end = _pos;
+    while (end < _input.length() && 
+           kDelimiters.find(_input[end]) == string_view::npos) {
+        ++end;
+    }
+    string_view word = _input.substr(_pos, end - _pos);
+    for (string_view keyword : kKeywords) {
+        if (word == keyword) return keyword;
+    }
+    return "";
+}
+
+/**
+ * Consume 'text' if it comes next as a word of its own.
+ */
+bool Parser::accept_word(string_view text)
+{
+    size_t end = _pos + text.length();
+    if (_input.substr(_pos, text.length()) != text ||
+        (end < _input.length() && 
+         kDelimiters.find(_input[end]) == string_view::npos)) {
+        return false;
+    }
+    _pos = end;
+    return true;
+}
+
+/**
+ * Consume the keyword that must come next.
+ */
+void Parser::expect_keyword(string_view keyword)
+{
+    skip_blanks();
+    if (at_end()) {
+        throw Executor::IncompleteInputException(
+            "syntax error: missing '" + string(keyword) + "'");
+    }
+    if (!accept_word(keyword)) unexpected();
+}
+
+/** Advance past any blanks, newlines, and single ';'s. */
+void Parser::skip_separators()
+{
+    while (!at_end() && (peek() == ' ' || peek() == '\t' || peek() == '\n' ||
+                         (peek() == ';' && peek(1) != ';'))) {
+        ++_pos;
+    }
+}
+
+/**
+ * Report a syntax error at the current position.
+ */
+void Parser::unexpected()
+{
+    if (at_end()) {
+        throw Executor::IncompleteInputException(
+            "syntax error: unexpected end of input");
+    }
+    size_t end = _pos;
+    while (end < _input.length() && 
+           kDelimiters.find(_input[end]) == string_view::npos) {
+        ++end;
+    }
+    if (end == _pos) {
+        /* an operator: one character, or two for ';;', '&&', and '||' */
+        ++end;
+        if (end < _input.length() && _input[end] == _input[_pos] &&
+            string_view(";&|").find(_input[end]) != string_view::npos) {
+            ++end;
+        }
+    }
+    string token = peek() == '\n' ? "newline" 
+                                  : string(_input.substr(_pos, end - _pos));
+    throw Executor::ExecutorException(
+        "syntax error near unexpected token '" + token + "'");
+}
+
+/**
+ * Parse commands separated by ';', '&', or newlines, up to the end of the
+ * input, or the first of the keywords 'stops' (which may include ';;')
+ * beginning a command. Empty commands are ignored.
+ */
+Sequence Parser::parse_sequence(std::initializer_list<string_view> stops)
+{
+    auto is_stop = [&](string_view word) {
+        return std::find(stops.begin(), stops.end(), word) != stops.end();
+    };
+
+    Sequence sequence;
+    while (true) {
+        skip_blanks();
+        if (at_end()) break;
+        if (peek() == ';' && peek(1) == ';') {
+            if (is_stop(";;")) break;
+            unexpected();
+        }
+        if (peek() == ';' || peek() == '\n') {
+            ++_pos;
+            continue;
+        }
+        string_view keyword = peek_keyword();
+        if (!keyword.empty() && is_stop(keyword)) break;
+
+        sequence.items.push_back(parse_and_or());
+        skip_blanks();
+        if (peek() == '&') {
+            sequence.items.back().background = true;
+            ++_pos;
+            continue;
+        }
+        if (!at_end() && peek() != ';' && peek() != '\n') unexpected();
+    }
+    return sequence;
+}
+
+/**
+ * Parse a sequence that must not be empty, like the condition or the body of
+ * an 'if'.
+ */
+Sequence Parser::parse_body(std::initializer_list<string_view> stops)
+{
+    Sequence sequence = parse_sequence(stops);
+    if (sequence.items.empty()) unexpected();
+    return sequence;
+}
+
+/**
+ * Parse one or more pipelines joined by '&&' or '||'. A newline may follow
+ * either operator.
+ */
+AndOr Parser::parse_and_or()
+{
+    AndOr and_or;
+    size_t start = _pos;
+    and_or.pipelines.push_back(parse_pipeline());
+    while (true) {
+        skip_blanks();
+        if (peek() == '&' && peek(1) == '&') {
+            and_or.connectors.push_back(AndOr::Connector::And);
+        }
+        else if (peek() == '|' && peek(1) == '|') {
+            and_or.connectors.push_back(AndOr::Connector::Or);
+        }
+        else {
+            break;
+        }
+        _pos += 2;
+        skip_separators();
+        and_or.pipelines.push_back(parse_pipeline());
+    }
+    and_or.source = _input.substr(start, _pos - start);
+    while (!and_or.source.empty() && 
+           (and_or.source.back() == ' ' || and_or.source.back() == '\t')) {
+        and_or.source.remove_suffix(1);
+    }
+    return and_or;
+}
+
+/**
+ * Parse one or more commands joined by '|', optionally preceded by '!'. A
+ * newline may follow the '|'.
+ */
+Pipeline Parser::parse_pipeline()
+{
+    Pipeline pipeline;
+    skip_blanks();
+    if (peek_keyword() == "!") {
+        pipeline.negated = true;
+        ++_pos;
+    }
+    while (true) {
+        pipeline.commands.emplace_back();
+        if (!parse_command(pipeline.commands.back())) {
+            if (pipeline.commands.size() > 1 && at_end()) {
+                throw Executor::IncompleteInputException(
+                    "Incomplete pipeline");
+            }
+            if (pipeline.commands.size() > 1 || 
+                (peek() == '|' && peek(1) != '|')) {
+                throw Executor::ExecutorException("Incomplete pipeline");
+            }
+            unexpected();
+        }
+        skip_blanks();
+        if (peek() != '|' || peek(1) == '|') break;
+        ++_pos;
+        while (!at_end() && (peek() == ' ' || peek() == '\t' || 
+                             peek() == '\n')) {
+            ++_pos;
+        }
+    }
+    return pipeline;
+}
+
+/**
+ * Parse a simple or compound command, or a function definition. A compound
+ * command may be followed by redirections, which apply to all of it.
+ *
+ * @param command An empty command to populate.
+ *
+ * @return 'false' if the command is empty, 'true' otherwise.
+ */
+bool Parser::parse_command(Command& command)
+{
+    skip_blanks();
+    string_view keyword = peek_keyword();
+    if (keyword.empty()) {
+        command.function_name = parse_function_name();
+        if (command.function_name.empty()) {
+            return parse_simple_command(command.simple);
+        }
+        /* the body may begin on the next line */
+        skip_separators();
+        keyword = peek_keyword();
+    }
+    if (keyword != "if" && keyword != "while" && keyword != "until" &&
+        keyword != "for" && keyword != "case" && keyword != "{") {
+        unexpected();
+    }
+    _pos += keyword.length();
+    command.compound = parse_compound(keyword);
+    // redirections of the whole compound command ('done > file')
+    while (true) {
+        skip_blanks();
+        if (peek() != '<' && peek() != '>') break;
+        parse_redirection(command.simple.redirections);
+    }
+    return true;
+}
+
+/**
+ * Consume the 'name()' that begins a function definition, if one comes next.
+ *
+ * @return The name, or "" if there is no definition.
+ */
+string_view Parser::parse_function_name()
+{
+    size_t start = _pos, end = _pos;
+    if (is_name_start(peek())) {
+        while (end < _input.length() && is_name_char(_input[end])) ++end;
+    }
+    if (end == start) return "";
+    _pos = end;
+    skip_blanks();
+    if (peek() == '(') {
+        ++_pos;
+        skip_blanks();
+        if (peek() == ')') {
+            ++_pos;
+            return _input.substr(start, end - start);
+        }
+    }
+    _pos = start;
+    return "";
+}
+
+/**
+ * Parse the rest of the compound command begun by 'keyword'.
+ */
+std::unique_ptr<CompoundCommand> Parser::parse_compound(string_view keyword)
+{
+    using Kind = CompoundCommand::Kind;
+    auto compound = std::make_unique<CompoundCommand>();
+
+    if (keyword == "if") {
+        compound->kind = Kind::If;
+        parse_if(*compound);
+    }
+    else if (keyword == "while" || keyword == "until") {
+        compound->kind = keyword == "while" ? Kind::While : Kind::Until;
+        compound->conditions.push_back(parse_body({"do"}));
+        expect_keyword("do");
+        compound->bodies.push_back(parse_body({"done"}));
+        expect_keyword("done");
+    }
+    else if (keyword == "for") {
+        compound->kind = Kind::For;
+        parse_for(*compound);
+    }
+    else if (keyword == "case") {
+        compound->kind = Kind::Case;
+        parse_case(*compound);
+    }
+    else {
+        compound->kind = Kind::Group;
+        compound->bodies.push_back(parse_body({"}"}));
+        expect_keyword("}");
+    }
+    return compound;
+}
+
+/**
+ * Parse 'COND; then BODY; [elif COND; then BODY;]... [else BODY;] fi'.
+ */
+void Parser::parse_if(CompoundCommand& compound)
+{
+    while (true) {
+        compound.conditions.push_back(parse_body({"then"}));
+        expect_keyword("then");
+        compound.bodies.push_back(parse_body({"elif", "else", "fi"}));
+        if (!accept_word("elif")) break;
+    }
+    if (accept_word("else")) compound.bodies.push_back(parse_body({"fi"}));
+    expect_keyword("fi");
+}
+
+/**
+ * Parse 'NAME [in WORD...]; do BODY; done'.
+ */
+void Parser::parse_for(CompoundCommand& compound)
+{
+    skip_blanks();
+    size_t start = _pos;
+    if (is_name_start(peek())) {
+        while (is_name_char(peek())) ++_pos;
+    }
+    compound.variable = _input.substr(start, _pos - start);
+    if (compound.variable.empty() || 
+        (!at_end() && kDelimiters.find(peek()) == string_view::npos)) {
+        unexpected();
+    }
+
+    skip_separators();
+    if (accept_word("in")) {
+        compound.has_in = true;
+        while (true) {
+            skip_blanks();
+            if (at_end() || peek() == ';' || peek() == '\n') break;
+            Word word;
+            if (!parse_word(word)) unexpected();
+            compound.words.push_back(std::move(word));
+        }
+        skip_separators();
+    }
+    expect_keyword("do");
+    compound.bodies.push_back(parse_body({"done"}));
+    expect_keyword("done");
+}
+
+/**
+ * Parse 'WORD in [[(]PATTERN [| PATTERN]...) BODY ;;]... esac'. The last
+ * body's ';;' is optional.
+ */
+void Parser::parse_case(CompoundCommand& compound)
+{
+    skip_blanks();
+    if (!parse_word(compound.subject)) unexpected();
+    skip_separators();
+    if (!accept_word("in")) unexpected();
+
+    while (true) {
+        skip_separators();
+        if (at_end()) {
+            throw Executor::IncompleteInputException(
+                "syntax error: missing 'esac'");
+        }
+        if (accept_word("esac")) break;
+
+        CaseItem& item = compound.items.emplace_back();
+        if (peek() == '(') ++_pos;
+        while (true) {
+            skip_blanks();
+            Word pattern;
+            if (!parse_word(pattern)) unexpected();
+            item.compiled.push_back(compile_pattern(pattern));
+            item.patterns.push_back(std::move(pattern));
+            skip_blanks();
+            if (peek() == '|') {
+                ++_pos;
+                continue;
+            }
+            if (peek() != ')') unexpected();
+            ++_pos;
+            break;
+        }
+        item.body = parse_sequence({"esac", ";;"});
+        if (peek() == ';' && peek(1) == ';') _pos += 2;
+    }
+}
+
+/**
+ * Parse words and redirections up to the next command separator or pipe.
+ *
+ * Leading words of the form 'name=value' are variable assignments, and are
+ * moved into 'cmd.assignments'. If there are other words too, the
+ * assignments only apply to the environment of the command they name.
+ *
+ * @param cmd An empty command to populate.
+ *
+ * @return 'false' if the command is empty, 'true' otherwise.
+ */
+bool Parser::parse_simple_command(SimpleCommand& cmd)
+{
+    while (true) {
+        skip_blanks();
+        if (at_end()) break;
+        char c = peek();
+        if (c == ';' || c == '\n' || c == '|' || c == '&' || c == '(' || 
+            c == ')') {
+            break;
+        }
+
+        /* I/O REDIRECTION */
+        if (c == '<' || c == '>') {
+            parse_redirection(cmd.redirections);
+            continue;
+        }
+
+        Word word;
+        if (parse_word(word)) cmd.words.push_back(std::move(word));
+    }
+
+    auto first_word = std::find_if_not(cmd.words.begin(), cmd.words.end(),
+                                       is_assignment);
+    for (auto it = cmd.words.begin(); it != first_word; ++it) {
+        cmd.assignments.push_back(to_assignment(*it));
+    }
+    cmd.words.erase(cmd.words.begin(), first_word);
+
+    return !cmd.words.empty() || !cmd.assignments.empty() ||
+           !cmd.redirections.empty();
+}
+
+/**
+ * Parse a '<' or '>' redirection (the next character) and its file name.
+ */
+void Parser::parse_redirection(std::vector<Redirection>& redirections)
+{
+    char c = peek();
+    ++_pos;
+    skip_blanks();
+    Redirection redirection {c == '<' ? Redirection::Kind::Input
+                                      : Redirection::Kind::Output, {}};
+    if (!parse_word(redirection.target)) {
+        if (peek() == '<' || peek() == '>') {
+            throw Executor::ExecutorException("missing redirection file name");
+        }
+        throw Executor::ExecutorException(c == '<'
+            ? "missing input file name" : "missing output file name");
+    }
+    redirections.push_back(std::move(redirection));
+}
+
+/**
+ * Append literal text to a word, merging it into the word's last part when
+ * that part is a literal with the same quoting. Merged text is only copied
+ * (into the arena) when the two pieces aren't already adjacent in the source.
+ */
+void Parser::append_literal(Word& word, string_view text, bool quoted)
+{
+    if (!word.parts.empty() &&
+        word.parts.back().kind == WordPart::Kind::Literal &&
+        word.parts.back().quoted == quoted) {
+        string_view& last = word.parts.back().text;
+        if (text.empty()) return;
+        if (last.data() + last.size() == text.data()) {
+            last = string_view(last.data(), last.size() + text.size());
+        }
+        else {
+            last = _arena.concat(last, text);
+        }
+    }
+    else {
+        word.parts.push_back(WordPart{WordPart::Kind::Literal, text, quoted});
+    }
+}
+
+/**
+ * Parse a single word, stopping at the first unquoted blank, command
+ * separator, operator, or parenthesis.
+ *
+ * @param word An empty word to populate.
+ *
+ * @return 'true' if anything (including an empty quoted string) was parsed
+ * into the word.
+ */
+bool Parser::parse_word(Word& word)
+{
+    while (!at_end()) {
+        switch (peek()) {
+            /* WORD SEPARATORS */
+            case ' ':
+            case '\t':
+            case ';':
+            case '\n':
+            case '|':
+            case '&':
+            case '(':
+            case ')':
+            case '<':
+            case '>':
+                return !word.parts.empty();
+            /* SPECIAL SYNTAX */
+            case '\\':
+                if (_pos + 1 == _input.length()) {
+                    throw Executor::IncompleteInputException(
+                        "Backslash appears as last character of line");
+                }
+                /* backslash-newline is a line continuation */
+                if (peek(1) != '\n') {
+                    append_literal(word, _input.substr(_pos + 1, 1), true);
+                }
+                _pos += 2;
+                continue;
+            case '\'':
+                parse_single_quoted(word);
+                continue;
+            case '"':
+                parse_double_quoted(word);
+                continue;
+            case '$':
+                parse_variable(word, false);
+                continue;
+            case '`':
+                parse_command_sub(word, false);
+                continue;
+            /* a run of ordinary characters */
+            default: {
+                size_t end = kWordSpecialChars.find(_input, _pos);
+                if (end == string_view::npos) end = _input.length();
+                append_literal(word, _input.substr(_pos, end - _pos), false);
+                _pos = end;
+                continue;
+            }
+        }
+    }
+    return !word.parts.empty();
+}
+
+/**
+ * Parse a single quoted string; its contents are taken literally.
+ */
+void Parser::parse_single_quoted(Word& word)
+{
+    size_t close = _input.find('\'', _pos + 1);
+    if (close == string_view::npos) {
+        throw Executor::IncompleteInputException(
+            "Unterminated single quotes");
+    }
+    append_literal(word, _input.substr(_pos + 1, close - _pos - 1), true);
+    _pos = close + 1;
+}
+
+/**
+ * Parse a double quoted string. Variable and command substitutions are
+ * recognized inside, and a backslash only escapes '$', '`', '"', '\', and
+ * newline.
+ */
+void Parser::parse_double_quoted(Word& word)
+{
+    ++_pos;
+    /* ensures that "" still produces an (empty) word */
+    append_literal(word, "", true);
+
+    while (true) {
+        if (at_end()) {
+            throw Executor::IncompleteInputException(
+                "Unterminated double quotes");
+        }
+        switch (peek()) {
+            case '"':
+                ++_pos;
+                return;
+            case '\\':
+                if (peek(1) == '\n') {
+                    _pos += 2;
+                }
+                else if (peek(1) != '\0' && string_view("$`\"\\").find(peek(1))
+                                            != string_view::npos) {
+                    append_literal(word, _input.substr(_pos + 1, 1), true);
+                    _pos += 2;
+                }
+                else {
+                    append_literal(word, "\\", true);
+                    ++_pos;
+                }
+                continue;
+            case '$':
+                parse_variable(word, true);
+                continue;
+            case '`':
+                parse_command_sub(word, true);
+                continue;
+            default: {
+                size_t end = kDoubleQuotedSpecialChars.find(_input, _pos);
+                if (end == string_view::npos) end = _input.length();
+                append_literal(word, _input.substr(_pos, end - _pos), true);
+                _pos = end;
+                continue;
+            }
+        }
+    }
+}
+
+/**
+ * Parse a variable reference: '$name', '${...}', or one of the special
+ * one-character variables '$#', '$*', '$?', and '$!'. A '$' that does not
+ * begin a variable name is taken literally. '$((' begins an arithmetic
+ * expansion.
+ */
+void Parser::parse_variable(Word& word, bool quoted)
+{
+    static const string_view ONE_CHAR_VARS = "#*?!";
+    size_t start = _pos + 1;
+    string_view name;
+
+    if (peek(1) == '(' && peek(2) == '(') {
+        parse_arithmetic(word, quoted);
+        return;
+    }
+    if (peek(1) == '{') {
+        parse_braced_parameter(word, quoted);
+        return;
+    }
+    if (peek(1) != '\0' && 
+             ONE_CHAR_VARS.find(peek(1)) != string_view::npos) {
+        name = _input.substr(start, 1);
+        _pos += 2;
+    }
+    else if (is_name_char(peek(1))) {
+        /* a name beginning with a digit consists only of digits */
+        bool digits = is_digit(peek(1));
+        size_t end = start;
+        while (end < _input.length() &&
+               (digits ? is_digit(_input[end]) : is_name_char(_input[end]))) {
+            ++end;
+        }
+        name = _input.substr(start, end - start);
+        _pos = end;
+    }
+    else {
+        append_literal(word, "$", quoted);
+        ++_pos;
+        return;
+    }
+
+    word.parts.push_back(WordPart{WordPart::Kind::Variable, name, quoted});
+}
+
+/**
+ * Parse a braced parameter expansion: '${name}', or '${name OP ...}' with one
+ * of the operators of ast::ParameterOp. Patterns without expansions are
+ * compiled here, once.
+ */
+void Parser::parse_braced_parameter(Word& word, bool quoted)
+{
+    using Kind = ParameterOp::Kind;
+    static const string_view ONE_CHAR_VARS = "#*?!";
+
+    _pos += 2;
+    ParameterOp *op = nullptr;
+    auto add_op = [&](Kind kind) {
+        op = &_list.parameter_ops.emplace_back();
+        op->kind = kind;
+    };
+
+    /* ${#name}, but ${#} is $# */
+    if (peek() == '#' && peek(1) != '}') {
+        add_op(Kind::Length);
+        ++_pos;
+    }
+
+    size_t start = _pos;
+    if (peek() != '\0' && ONE_CHAR_VARS.find(peek()) != string_view::npos) {
+        ++_pos;
+    }
+    else if (is_digit(peek())) {
+        while (is_digit(peek())) ++_pos;
+    }
+    else if (is_name_start(peek())) {
+        while (is_name_char(peek())) ++_pos;
+    }
+    string_view name = _input.substr(start, _pos - start);
+    if (name.empty() && !at_end()) {
+        throw Executor::ExecutorException("empty/invalid variable name");
+    }
+
+    if (!op) {
+        switch (peek()) {
+            case '#':
+            case '%': {
+                char c = peek();
+                add_op(c == '#' ? Kind::RemovePrefix : Kind::RemoveSuffix);
+                op->doubled = peek(1) == c;
+                _pos += op->doubled ? 2 : 1;
+                parse_operand(op->operand, "}");
+                break;
+            }
+            case '/':
+                add_op(Kind::Replace);
+                op->doubled = peek(1) == '/';
+                _pos += op->doubled ? 2 : 1;
+                if (!op->doubled && (peek() == '#' || peek() == '%')) {
+                    op->anchor = peek();
+                    ++_pos;
+                }
+                parse_operand(op->operand, "/}");
+                if (peek() == '/') {
+                    ++_pos;
+                    parse_operand(op->replacement, "}");
+                }
+                break;
+            case ':':
+                if (peek(1) == '-') {
+                    add_op(Kind::Default);
+                    _pos += 2;
+                    parse_operand(op->operand, "}");
+                    break;
+                }
+                add_op(Kind::Substring);
+                start = ++_pos;
+                while (!at_end() && peek() != ':' && peek() != '}') ++_pos;
+                op->offset = _input.substr(start, _pos - start);
+                if (peek() == ':') {
+                    op->has_length = true;
+                    start = ++_pos;
+                    while (!at_end() && peek() != '}') ++_pos;
+                    op->length = _input.substr(start, _pos - start);
+                }
+                break;
+        }
+    }
+
+    if (at_end()) {
+        throw Executor::IncompleteInputException(
+            "Unterminated braces for variable name");
+    }
+    if (peek() != '}') {
+        throw Executor::ExecutorException("bad substitution");
+    }
+    ++_pos;
+
+    if (op && (op->kind == Kind::RemovePrefix || 
+               op->kind == Kind::RemoveSuffix || op->kind == Kind::Replace)) {
+        op->pattern = compile_pattern(op->operand);
+    }
+
+    WordPart part {WordPart::Kind::Variable, name, quoted};
+    part.op = op;
+    word.parts.push_back(part);
+}
+
+/**
+ * Parse the operand of a parameter expansion operator, up to (not including)
+ * the first unquoted character of 'stops'. Quotes and substitutions work as
+ * in a word, but blanks and operators are ordinary characters.
+ */
+void Parser::parse_operand(Word& word, string_view stops)
+{
+    static const string_view SPECIAL = "\\'\"$`";
+    while (!at_end() && stops.find(peek()) == string_view::npos) {
+        switch (peek()) {
+            case '\\':
+                if (_pos + 1 == _input.length()) {
+                    throw Executor::IncompleteInputException(
+                        "Unterminated braces for variable name");
+                }
+                if (peek(1) != '\n') {
+                    append_literal(word, _input.substr(_pos + 1, 1), true);
+                }
+                _pos += 2;
+                continue;
+            case '\'':
+                parse_single_quoted(word);
+                continue;
+            case '"':
+                parse_double_quoted(word);
+                continue;
+            case '$':
+                parse_variable(word, false);
+                continue;
+            case '`':
+                parse_command_sub(word, false);
+                continue;
+            default: {
+                size_t end = _pos;
+                while (end < _input.length() && 
+                       stops.find(_input[end]) == string_view::npos &&
+                       SPECIAL.find(_input[end]) == string_view::npos) {
+                    ++end;
+                }
+                append_literal(word, _input.substr(_pos, end - _pos), false);
+                _pos = end;
+                continue;
+            }
+        }
+    }
+}
+
+/**
+ * Parse an arithmetic expansion, '$((expression))'. The expression is kept
+ * as is, to be evaluated when the word is expanded; only its parentheses
+ * need to balance here.
+ */
+void Parser::parse_arithmetic(Word& word, bool quoted)
+{
+    size_t start = _pos + 3;
+    int depth = 0;
+    for (size_t i = start; i < _input.length(); ++i) {
+        if (_input[i] == '(') {
+            ++depth;
+        }
+        else if (_input[i] == ')') {
+            if (depth == 0) {
+                if (i + 1 == _input.length() || _input[i + 1] != ')') break;
+                word.parts.push_back(WordPart{WordPart::Kind::Arithmetic, 
+                    _input.substr(start, i - start), quoted});
+                _pos = i + 2;
+                return;
+            }
+            --depth;
+        }
+    }
+    throw Executor::IncompleteInputException(
+        "Unterminated arithmetic expansion");
+}
+
+/**
+ * Parse a backquoted command substitution. Inside the backquotes, a
+ * backslash only escapes '$', '`', and '\'; the resulting text is kept as the
+ * source of the subcommand, to be parsed when it is executed.
+ */
+void Parser::parse_command_sub(Word& word, bool quoted)
+{
+    static const string_view ESCAPABLE = "`\\$";
+    size_t start = _pos + 1;
+    bool has_escapes = false;
+
+    /* find the closing backquote */
+    size_t end = start;
+    while (true) {
+        if (end >= _input.length()) {
+            throw Executor::IncompleteInputException(
+                "Unterminated command substitution");
+        }
+        if (_input[end] == '`') break;
+        if (_input[end] == '\\' && end + 1 < _input.length() &&
+            ESCAPABLE.find(_input[end + 1]) != string_view::npos) {
+            has_escapes = true;
+            ++end;
+        }
+        ++end;
+    }
+    string_view subcommand = _input.substr(start, end - start);
+    _pos = end + 1;
+
+    /* CASE: escapes must be removed, so the subcommand needs its own copy */
+    if (has_escapes) {
+        string unescaped;
+        for (size_t i = 0; i < subcommand.length(); ++i) {
+            if (subcommand[i] == '\\' && i + 1 < subcommand.length() &&
+                ESCAPABLE.find(subcommand[i + 1]) != string_view::npos) {
+                ++i;
+            }
+            unescaped += subcommand[i];
+        }
+        subcommand = _arena.copy(unescaped);
+    }
+
+    word.parts.push_back(
+        WordPart{WordPart::Kind::CommandSub, subcommand, quoted});
+}
+
+
+/**
+ * Checks if a word has the form of a variable assignment.
+ * Rules:
+ *  1. the word begins with an unquoted literal
+ *  2. whose initial character is a letter followed by any number of letters,
+ *     digits, or underscores
+ *  3. followed by a '='
+ *  4. the rest is the variable's value, and has no format requirements
+ */
+static bool is_assignment(const Word& word)
+{
+    const WordPart& first = word.parts.front();
+    if (first.kind != WordPart::Kind::Literal || first.quoted) return false;
+
+    string_view text = first.text;
+    size_t eq_idx = text.find('=');
+    if (eq_idx == string_view::npos || eq_idx == 0) return false;
+    if (!is_name_start(text[0])) return false;
+
+    return std::all_of(text.begin() + 1, text.begin() + eq_idx, is_name_char);
+}
+
+/**
+ * Split an assignment word into its variable name and value.
+ */
+static Assignment to_assignment(Word& word)
+{
+    Assignment assignment;
+    string_view& text = word.parts.front().text;
+    size_t eq_idx = text.find('=');
+    assignment.name = text.substr(0, eq_idx);
+
+    text.remove_prefix(eq_idx + 1);
+    if (text.empty()) word.parts.erase(word.parts.begin());
+    assignment.value = std::move(word);
+    return assignment;
+}
+
+/**
+ * Compile a pattern word that contains no expansions; quoted parts match
+ * literally.
+ *
+ * @return The compiled pattern, or std::nullopt if the word has expansions
+ *         (it must then be compiled each time it is expanded).
+ */
+static std::optional<GlobPattern> compile_pattern(const Word& word)
+{
+    string pattern;
+    for (const WordPart& part : word.parts) {
+        if (part.kind != WordPart::Kind::Literal) return std::nullopt;
+        pattern += part.quoted ? GlobPattern::escape(part.text) 
+                               : string(part.text);
+    }
+    return GlobPattern(pattern);
+}
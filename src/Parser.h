@@ -0,0 +1,234 @@
+#pragma once
+#include "util/arena.h"
+#include "util/glob.h"
+#include <deque>
+#include <initializer_list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * The typed syntax tree produced by Parser. A CLASH script is a sequence of
+ * pipelines, optionally joined by '&&' and '||'; a pipeline is a sequence of
+ * commands joined by '|'. A command is either a simple command (words plus
+ * I/O redirections) or a compound command (if, while, until, for, case, or a
+ * '{ ...; }' group, plus redirections), which holds sequences of its own, or
+ * the definition of a function whose body is a compound command.
+ *
+ * Words keep quoting and expansions as separate parts, so that the Executor
+ * can perform variable/command substitution, arithmetic expansion, and word
+ * splitting directly on the tree without re-scanning any text.
+ *
+ * All text in the tree is a string_view into the CommandList's own copy of
+ * the source, or, where unescaping produced new text, into its arena. The
+ * tree therefore stays valid for as long as its CommandList does.
+ */
+namespace ast {
+    struct ParameterOp;
+
+    /* one piece of a word: literal text or a pending expansion */
+    struct WordPart {
+        enum class Kind { Literal, Variable, CommandSub, Arithmetic };
+
+        Kind kind;
+        /* literal text, variable name, command substitution source, or
+           arithmetic expression */
+        std::string_view text;
+        /* quoted parts are never subject to word splitting */
+        bool quoted = false;
+        /* for variables: the operator applied to the value, if any */
+        const ParameterOp *op = nullptr;
+    };
+
+    struct Word {
+        std::vector<WordPart> parts;
+    };
+
+    /* the operator of a parameter expansion, '${name OP ...}' */
+    struct ParameterOp {
+        enum class Kind {
+            Length,        // ${#name}
+            RemovePrefix,  // ${name#pattern}, ${name##pattern}
+            RemoveSuffix,  // ${name%pattern}, ${name%%pattern}
+            Replace,       // ${name/pattern/replacement}, ${name//...},
+                           // ${name/#...}, ${name/%...}
+            Substring,     // ${name:offset}, ${name:offset:length}
+            Default,       // ${name:-word}
+        };
+
+        Kind kind;
+        /* '##', '%%', '//': remove the longest match, replace every match */
+        bool doubled = false;
+        /* '#' or '%' if the replaced match must be a prefix or suffix */
+        char anchor = 0;
+        /* the pattern, or the default word */
+        Word operand;
+        Word replacement;
+        /* arithmetic expressions */
+        std::string_view offset;
+        std::string_view length;
+        bool has_length = false;
+        /* the pattern compiled, if it contains no expansions */
+        std::optional<GlobPattern> pattern;
+    };
+
+    struct Redirection {
+        enum class Kind { Input, Output };
+
+        Kind kind;
+        Word target;
+    };
+
+    struct Assignment {
+        std::string_view name;
+        Word value;
+    };
+
+    struct SimpleCommand {
+        /* variable assignments, or (if there are words) assignments to the
+           environment of this command only */
+        std::vector<Assignment> assignments;
+        std::vector<Word> words;
+        std::vector<Redirection> redirections;
+    };
+
+    struct CompoundCommand;
+
+    /* exactly one of 'simple' and 'compound' is set, except that the
+       redirections of a compound command are kept in 'simple' */
+    struct Command {
+        SimpleCommand simple;
+        std::unique_ptr<CompoundCommand> compound;
+        /* set for a function definition, 'name() compound' */
+        std::string_view function_name;
+    };
+
+    struct Pipeline {
+        std::vector<Command> commands;
+        /* '!': the exit status is inverted */
+        bool negated = false;
+    };
+
+    /* pipelines joined by '&&' and '||' */
+    struct AndOr {
+        enum class Connector { And, Or };
+
+        std::vector<Pipeline> pipelines;
+        /* connectors[i] joins pipelines[i] and pipelines[i + 1] */
+        std::vector<Connector> connectors;
+        /* followed by '&' */
+        bool background = false;
+        /* the source text, for listing jobs */
+        std::string_view source;
+    };
+
+    /* commands separated by ';', '&', or newlines */
+    struct Sequence {
+        std::vector<AndOr> items;
+    };
+
+    /* 'pattern | pattern) body ;;' */
+    struct CaseItem {
+        std::vector<Word> patterns;
+        /* the patterns compiled, where they contain no expansions */
+        std::vector<std::optional<GlobPattern>> compiled;
+        Sequence body;
+    };
+
+    struct CompoundCommand {
+        enum class Kind { If, While, Until, For, Case, Group };
+
+        Kind kind;
+        /* If: the conditions of 'if' and each 'elif'. While/Until: the loop
+           condition. */
+        std::vector<Sequence> conditions;
+        /* If: the body of each condition, then that of 'else', if any. 
+           Others: the one body. */
+        std::vector<Sequence> bodies;
+        /* For: the loop variable, and the words after 'in' (without 'in', 
+           the loop is over the positional parameters) */
+        std::string_view variable;
+        std::vector<Word> words;
+        bool has_in = false;
+        /* Case */
+        Word subject;
+        std::vector<CaseItem> items;
+    };
+
+    struct CommandList {
+        CommandList(std::string_view input) 
+          : arena(2 * input.size() + 64), source(arena.copy(input)) {}
+        CommandList(const CommandList&) = delete;
+        CommandList& operator=(const CommandList&) = delete;
+
+        /* owns all text referenced by the tree; declared first so that it
+           is constructed before 'source' */
+        Arena arena;
+        std::string_view source;
+        Sequence body;
+        /* referenced by the word parts they apply to */
+        std::deque<ParameterOp> parameter_ops;
+    };
+}
+
+
+/**
+ * A Parser fills in an ast::CommandList from its source in a single
+ * left-to-right pass. Quoting, escaping, and the boundaries of variable and
+ * command substitutions are resolved here, once; nothing is expanded. Text
+ * that needs no unescaping is never copied.
+ *
+ * Exceptions: parse() throws an Executor::ExecutorException for malformed
+ * input, and more specifically an Executor::IncompleteInputException when the
+ * input ends in the middle of a command (unterminated quotes, a pipeline
+ * ending in '|', an 'if' without 'fi', etc), which further lines could
+ * complete.
+ */
+class Parser {
+  public:
+    Parser(ast::CommandList& list) 
+      : _list(list), _input(list.source), _arena(list.arena) {}
+    void parse();
+
+  private:
+    ast::CommandList& _list;
+    std::string_view _input;
+    Arena& _arena;
+    size_t _pos = 0;
+
+    bool at_end() const { return _pos >= _input.length(); }
+    char peek(size_t ahead = 0) const;
+    void skip_blanks();
+    void append_literal(ast::Word& word, std::string_view text, bool quoted);
+
+    std::string_view peek_keyword() const;
+    void expect_keyword(std::string_view keyword);
+    bool accept_word(std::string_view text);
+    void skip_separators();
+    [[noreturn]] void unexpected();
+
+    ast::Sequence parse_sequence(
+        std::initializer_list<std::string_view> stops);
+    ast::Sequence parse_body(std::initializer_list<std::string_view> stops);
+    ast::AndOr parse_and_or();
+    ast::Pipeline parse_pipeline();
+    bool parse_command(ast::Command& command);
+    std::string_view parse_function_name();
+    std::unique_ptr<ast::CompoundCommand> parse_compound(
+        std::string_view keyword);
+    void parse_if(ast::CompoundCommand& compound);
+    void parse_for(ast::CompoundCommand& compound);
+    void parse_case(ast::CompoundCommand& compound);
+    bool parse_simple_command(ast::SimpleCommand& cmd);
+    void parse_redirection(std::vector<ast::Redirection>& redirections);
+    bool parse_word(ast::Word& word);
+    void parse_single_quoted(ast::Word& word);
+    void parse_double_quoted(ast::Word& word);
+    void parse_variable(ast::Word& word, bool quoted);
+    void parse_braced_parameter(ast::Word& word, bool quoted);
+    void parse_operand(ast::Word& word, std::string_view stops);
+    void parse_arithmetic(ast::Word& word, bool quoted);
+    void parse_command_sub(ast::Word& word, bool quoted);
+};
@@ -0,0 +1,436 @@
+#include "PathIndex.h"
+#include "loguru/loguru.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+using std::string;
+using std::string_view;
+
+namespace {
+    /* how long directory mtimes are trusted before being checked again */
+    const auto kRecheckInterval = std::chrono::seconds(1);
+
+    struct timespec modification_time(const struct stat &st)
+    {
+#ifdef __APPLE__
+        return st.st_mtimespec;
+#else
+        return st.st_mtim;
+#endif
+    }
+
+    /* the mtime recorded for directories that don't exist */
+    const struct timespec kMissing = {-1, 0};
+
+    struct timespec directory_mtime(const string &path)
+    {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 ? modification_time(st) 
+                                            : kMissing;
+    }
+
+    bool same_time(const struct timespec &a, const struct timespec &b)
+    {
+        return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+    }
+
+    /*
+     * Cache file layout (native byte order; the magic number doubles as a
+     * byte order check):
+     *
+     *   CacheHeader
+     *   the PATH string (path_length bytes)
+     *   CacheDirectory, for each directory of PATH (in order)
+     *   CacheCommand followed by its name (name_length bytes), per command
+     */
+    const uint32_t kCacheMagic = 0x434c5043; // "CLPC"
+    const uint32_t kCacheVersion = 1;
+
+    struct CacheHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t path_length;
+        uint32_t n_directories;
+        uint32_t n_commands;
+    };
+
+    struct CacheDirectory {
+        int64_t mtime_sec;
+        int64_t mtime_nsec;
+        uint32_t has_mtime;
+    };
+
+    struct CacheCommand {
+        uint32_t dir_index;
+        uint32_t name_length;
+    };
+
+    /* reads records out of a mapped cache file, checking bounds */
+    class CacheReader {
+      public:
+        CacheReader(const char *data, size_t size) : _data(data), _end(size) {}
+
+        template <typename T>
+        bool read(T &record) {
+            if (_end - _pos < sizeof(T)) return false;
+            std::memcpy(&record, _data + _pos, sizeof(T));
+            _pos += sizeof(T);
+            return true;
+        }
+
+        bool read(string_view &text, size_t length) {
+            if (_end - _pos < length) return false;
+            text = string_view(_data + _pos, length);
+            _pos += length;
+            return true;
+        }
+
+      private:
+        const char *_data;
+        size_t _pos = 0;
+        size_t _end;
+    };
+
+#ifdef __linux__
+    /* the record format of getdents64(2), which glibc doesn't declare */
+    struct linux_dirent64 {
+        ino64_t d_ino;
+        off64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[];
+    };
+#endif
+
+    /**
+     * Call 'fn' with the name of every entry of the open directory 'fd' that
+     * might be an executable (i.e. isn't known to be a directory).
+     */
+    template <typename Fn>
+    void for_each_entry(int fd, Fn fn)
+    {
+#ifdef __linux__
+        /* read the raw records, many per system call, without going through
+           a heap-allocated DIR* */
+        alignas(linux_dirent64) char buf[32768];
+        for (;;) {
+            long n_read = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+            if (n_read <= 0) return;
+            for (long pos = 0; pos < n_read; ) {
+                auto *entry = reinterpret_cast<linux_dirent64*>(buf + pos);
+                pos += entry->d_reclen;
+                if (entry->d_type != DT_DIR) fn(entry->d_name);
+            }
+        }
+#else
+        DIR *dir = fdopendir(dup(fd));
+        if (!dir) return;
+        while (struct dirent *entry = readdir(dir)) {
+            if (entry->d_type != DT_DIR) fn(entry->d_name);
+        }
+        closedir(dir);
+#endif
+    }
+}
+
+void PathIndex::set_path(string_view PATH)
+{
+    if (_has_path && PATH == _PATH) return;
+    _PATH = PATH;
+    _has_path = true;
+    _dirs.clear();
+    _commands.clear();
+    _missing.clear();
+
+    bool has_dot = false;
+    size_t start = 0;
+    while (start <= PATH.length()) {
+        size_t end = PATH.find(':', start);
+        if (end == string_view::npos) end = PATH.length();
+        // an empty entry means the current directory
+        string dir(end > start ? PATH.substr(start, end - start) : ".");
+        has_dot = has_dot || dir == ".";
+        _dirs.push_back(Directory{dir, dir[0] != '/'});
+        start = end + 1;
+    }
+    if (!has_dot) _dirs.push_back(Directory{".", true});
+    _first_relative_dir = 0;
+    while (!_dirs[_first_relative_dir].is_relative) ++_first_relative_dir;
+    _last_check = std::chrono::steady_clock::now();
+}
+
+const string* PathIndex::find(string_view name)
+{
+    auto now = std::chrono::steady_clock::now();
+    bool rechecked = false;
+    if (now - _last_check >= kRecheckInterval) {
+        recheck_directories();
+        rechecked = true;
+    }
+
+    /* a remembered command is still the answer as long as no directory
+       before it could have changed behind our back */
+    auto it = _commands.find(string(name));
+    if (it != _commands.end()) {
+        if (it->second.dir_index < _first_relative_dir) {
+            ++it->second.hits;
+            ++n_remembered_hits;
+            return &it->second.path;
+        }
+    }
+
+    /* a command known to be missing from the absolute directories can
+       only turn up in a relative one (until the next recheck) */
+    if (_missing.find(string(name)) != _missing.end()) {
+        ++n_missing_hits;
+        return search(name, true);
+    }
+
+    bool searched_all = false;
+    const string *path = search(name, false, &searched_all);
+    if (!path && !rechecked) {
+        // it may have been installed since the directories were last read
+        recheck_directories();
+        path = search(name, false, &searched_all);
+    }
+    // a match in a relative directory before some absolute ones says 
+    // nothing about those
+    if (searched_all && (!path || path == &_relative_match)) {
+        _missing.emplace(name);
+    }
+    return path;
+}
+
+void PathIndex::hash_all()
+{
+    for (Directory &dir : _dirs) {
+        if (!dir.is_relative && !dir.is_hashed) hash_directory(dir);
+    }
+}
+
+void PathIndex::clear()
+{
+    _commands.clear();
+    _missing.clear();
+    for (Directory &dir : _dirs) {
+        dir.is_hashed = false;
+        dir.has_mtime = false;
+        dir.entries.clear();
+    }
+    _dirty = true;
+}
+
+void PathIndex::load(const string &cache_file)
+{
+    int fd = open(cache_file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return;
+    struct stat st;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) return;
+
+    CacheReader reader(static_cast<const char*>(mapping), st.st_size);
+    CacheHeader header;
+    string_view PATH;
+    bool ok = reader.read(header) && header.magic == kCacheMagic &&
+              header.version == kCacheVersion &&
+              reader.read(PATH, header.path_length) && PATH == _PATH &&
+              header.n_directories == _dirs.size();
+
+    /* commands are only valid if found before the first directory that has
+       changed (or was never read), since that directory may now hold a
+       command of the same name */
+    size_t n_valid_dirs = _dirs.size();
+    for (size_t i = 0; ok && i < _dirs.size(); ++i) {
+        CacheDirectory record;
+        if (!reader.read(record)) {
+            ok = false;
+            break;
+        }
+        if (i >= n_valid_dirs) continue;
+        Directory &dir = _dirs[i];
+        struct timespec mtime = {static_cast<time_t>(record.mtime_sec), 
+                                 static_cast<long>(record.mtime_nsec)};
+        if (dir.is_relative || !record.has_mtime || 
+            !same_time(directory_mtime(dir.path), mtime)) {
+            n_valid_dirs = i;
+            continue;
+        }
+        dir.mtime = mtime;
+        dir.has_mtime = true;
+    }
+
+    for (uint32_t i = 0; ok && i < header.n_commands; ++i) {
+        CacheCommand record;
+        string_view name;
+        if (!reader.read(record) || !reader.read(name, record.name_length)) {
+            ok = false;
+            break;
+        }
+        if (record.dir_index >= n_valid_dirs) continue;
+        const Directory &dir = _dirs[record.dir_index];
+        _commands.emplace(string(name), 
+            Command{dir.path + "/" + string(name), record.dir_index, 0});
+    }
+    munmap(mapping, st.st_size);
+
+    if (!ok) {
+        LOG_F(INFO, "ignoring PATH cache file %s", cache_file.c_str());
+        _commands.clear();
+    }
+    // anything dropped as stale is worth rewriting
+    _dirty = !ok || n_valid_dirs < _dirs.size();
+}
+
+bool PathIndex::save(const string &cache_file)
+{
+    if (!_dirty) return true;
+
+    string data;
+    auto append = [&](const void *record, size_t size) {
+        data.append(static_cast<const char*>(record), size);
+    };
+    CacheHeader header = {kCacheMagic, kCacheVersion, 
+                          static_cast<uint32_t>(_PATH.size()), 
+                          static_cast<uint32_t>(_dirs.size()), 0};
+    for (const auto &entry : _commands) {
+        if (entry.second.dir_index < _first_relative_dir) ++header.n_commands;
+    }
+    append(&header, sizeof(header));
+    data += _PATH;
+    for (const Directory &dir : _dirs) {
+        CacheDirectory record = {dir.mtime.tv_sec, dir.mtime.tv_nsec, 
+                                 dir.has_mtime && !dir.is_relative};
+        append(&record, sizeof(record));
+    }
+    for (const auto &[name, command] : _commands) {
+        // commands found past a relative directory need a search anyway
+        if (command.dir_index >= _first_relative_dir) continue;
+        CacheCommand record = {static_cast<uint32_t>(command.dir_index), 
+                               static_cast<uint32_t>(name.size())};
+        append(&record, sizeof(record));
+        data += name;
+    }
+
+    /* write a temporary file next to the cache, then rename it over it */
+    string temp_file = cache_file + ".XXXXXX";
+    int fd = mkstemp(&temp_file[0]);
+    if (fd == -1) return false;
+    bool ok = true;
+    for (size_t written = 0; ok && written < data.size(); ) {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n == -1 && errno == EINTR) continue;
+        ok = n > 0;
+        if (ok) written += n;
+    }
+    ok = close(fd) == 0 && ok;
+    if (ok) ok = rename(temp_file.c_str(), cache_file.c_str()) == 0;
+    if (!ok) unlink(temp_file.c_str());
+    else _dirty = false;
+    return ok;
+}
+
+/**
+ * Search the directories in order, reading the ones not read yet, and
+ * remember the command if it is found in an absolute directory.
+ * 
+ * @param relative_only Skip the absolute directories.
+ * @param searched_all If not null, set to whether every absolute directory
+ *                     was searched (rather than a relative one matching 
+ *                     before some of them).
+ */
+const string* PathIndex::search(string_view name, bool relative_only,
+                                bool *searched_all)
+{
+    for (size_t i = 0; i < _dirs.size(); ++i) {
+        Directory &dir = _dirs[i];
+        if (dir.is_relative) {
+            _relative_match = dir.path + "/" + string(name);
+            if (access(_relative_match.c_str(), X_OK) == 0) {
+                if (searched_all) {
+                    *searched_all = std::none_of(
+                        _dirs.begin() + i + 1, _dirs.end(),
+                        [](const Directory &d) { return !d.is_relative; });
+                }
+                return &_relative_match;
+            }
+            continue;
+        }
+        if (relative_only) continue;
+
+        if (!dir.is_hashed) hash_directory(dir);
+        if (dir.entries.find(string(name)) == dir.entries.end()) continue;
+        string path = dir.path + "/" + string(name);
+        // entries aren't checked for permissions (or being a file) until
+        // they are looked up
+        struct stat st;
+        if (access(path.c_str(), X_OK) != 0 || stat(path.c_str(), &st) != 0 ||
+            S_ISDIR(st.st_mode)) {
+            continue;
+        }
+        Command &command = _commands[string(name)];
+        command = Command{path, i, 1};
+        _dirty = true;
+        return &command.path;
+    }
+    if (searched_all) *searched_all = true;
+    return nullptr;
+}
+
+/**
+ * Check every read directory's mtime, and drop the contents of those that
+ * have changed (along with all remembered commands, since one of them may
+ * now be shadowed or gone).
+ */
+void PathIndex::recheck_directories()
+{
+    _last_check = std::chrono::steady_clock::now();
+    for (Directory &dir : _dirs) {
+        if (!dir.has_mtime) continue;
+        if (same_time(directory_mtime(dir.path), dir.mtime)) continue;
+        LOG_F(INFO, "PATH directory changed: %s", dir.path.c_str());
+        dir.is_hashed = false;
+        dir.has_mtime = false;
+        dir.entries.clear();
+        _commands.clear();
+        _missing.clear();
+        _dirty = true;
+    }
+}
+
+void PathIndex::hash_directory(Directory &dir)
+{
+    ++n_directory_reads;
+    dir.is_hashed = true;
+    dir.entries.clear();
+    int fd = open(dir.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct stat st;
+    struct timespec mtime = kMissing;
+    if (fd != -1 && fstat(fd, &st) == 0) mtime = modification_time(st);
+
+    // commands remembered from a cache file may be out of date
+    if (dir.has_mtime && !same_time(mtime, dir.mtime)) {
+        _commands.clear();
+        _missing.clear();
+    }
+    dir.mtime = mtime;
+    dir.has_mtime = true;
+
+    if (fd == -1) return;
+    for_each_entry(fd, [&](const char *name) { dir.entries.emplace(name); });
+    close(fd);
+}
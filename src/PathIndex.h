@@ -0,0 +1,122 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * Resolves command names to executables by searching the directories of a
+ * PATH string in order, like execvp does, but without probing each
+ * directory with a system call on every lookup.
+ *
+ * Each absolute directory is read once (with getdents64 on Linux) into a
+ * hash set of its entry names, the first time a lookup reaches it. The
+ * directories' modification times are rechecked at most once per second,
+ * and whenever a command is not found at all; a directory whose mtime has
+ * changed is read again. Relative directories (such as '.') depend on the
+ * working directory, so they are never hashed and are probed with access()
+ * instead.
+ *
+ * Names that aren't found in any absolute directory are remembered too, so
+ * that probing for a missing command again (e.g. in a loop) only checks the
+ * relative directories. Like the directory contents, they are trusted until
+ * the next mtime recheck.
+ *
+ * Successful lookups are remembered along with their number of hits, which
+ * is what the 'hash' builtin lists. They can also be saved to a cache file
+ * and loaded by later processes with the same PATH, as long as the
+ * directories involved haven't changed since (see load() and save()).
+ */
+class PathIndex {
+  public:
+    /** A remembered lookup. */
+    struct Command {
+        std::string path;
+        /* index of the directory the command was found in */
+        size_t dir_index;
+        size_t hits;
+    };
+
+    /**
+     * Use the directories of 'PATH', a colon-separated list. Does nothing if
+     * 'PATH' hasn't changed since the last call; otherwise everything hashed
+     * and remembered so far is dropped. '.' is searched after the
+     * directories of PATH (if PATH doesn't already contain it).
+     */
+    void set_path(std::string_view PATH);
+
+    /**
+     * Returns the full path of the executable that 'name' (which must not
+     * contain a '/') resolves to, or nullptr if there is none. The result is
+     * valid until the next call.
+     */
+    const std::string* find(std::string_view name);
+
+    /** Read every (absolute) directory of the PATH now, if not yet read. */
+    void hash_all();
+
+    /** Forget all remembered commands (found or missing) and directory 
+        contents. */
+    void clear();
+
+    /**
+     * Remember the commands saved in a cache file by an index with the same
+     * PATH, except those from directories modified since they were saved.
+     * Call after set_path(). Missing, stale, or malformed files are ignored.
+     */
+    void load(const std::string &cache_file);
+
+    /**
+     * Save the remembered commands to a cache file, if anything has been
+     * learned since the index was loaded. The file is replaced atomically,
+     * so concurrent readers see either the old or the new version.
+     *
+     * @return 'false' if the file could not be written.
+     */
+    bool save(const std::string &cache_file);
+
+    const std::unordered_map<std::string, Command>& commands() const {
+        return _commands;
+    }
+
+    /* counters, for the executor statistics */
+    size_t n_remembered_hits = 0;
+    size_t n_missing_hits = 0;
+    size_t n_directory_reads = 0;
+
+  private:
+    struct Directory {
+        std::string path;
+        bool is_relative;
+        bool is_hashed = false;
+        /* set once the mtime is known: when hashed, or loaded from a cache
+           file and still current */
+        bool has_mtime = false;
+        struct timespec mtime = {};
+        std::unordered_set<std::string> entries;
+    };
+
+    std::string _PATH;
+    bool _has_path = false;
+    std::vector<Directory> _dirs;
+    /* commands found before this directory need no search to stay valid */
+    size_t _first_relative_dir = 0;
+    std::unordered_map<std::string, Command> _commands;
+    /* names not found in any absolute directory */
+    std::unordered_set<std::string> _missing;
+    std::chrono::steady_clock::time_point _last_check;
+    /* true if there is anything new to save */
+    bool _dirty = false;
+    /* the result of the last lookup in a relative directory */
+    std::string _relative_match;
+
+    void recheck_directories();
+    void hash_directory(Directory &dir);
+    const std::string* search(std::string_view name, 
+                              bool relative_only = false,
+                              bool *searched_all = nullptr);
+};
@@ -0,0 +1,179 @@
+#include "VarStore.h"
+#include <cctype>
+#include <charconv>
+
+using std::string;
+using std::string_view;
+
+std::optional<string_view> VarStore::find(string_view name)
+{
+    if (name.empty()) return std::nullopt;
+
+    /* SPECIAL PARAMETERS */
+    const Positional &positional = _frames[_n_frames - 1];
+    if (std::isdigit(static_cast<unsigned char>(name[0]))) {
+        size_t index = 0;
+        for (char c : name) {
+            index = index * 10 + (c - '0');
+            if (index >= positional.params.size()) return std::nullopt;
+        }
+        return string_view(positional.params[index]);
+    }
+    if (name == "PIPESTATUS") {
+        if (_pipe_status.empty()) return status_text();
+        if (!_pipe_status_formatted) {
+            _pipe_status_text.clear();
+            for (int status : _pipe_status) {
+                if (!_pipe_status_text.empty()) _pipe_status_text += ' ';
+                _pipe_status_text += std::to_string(status);
+            }
+            _pipe_status_formatted = true;
+        }
+        return string_view(_pipe_status_text);
+    }
+    if (name.size() == 1) {
+        switch (name[0]) {
+            case '?':
+                return status_text();
+            case '#':
+                return string_view(positional.count);
+            case '*':
+                return string_view(positional.all);
+            case '!':
+                if (_background_pid.empty()) return std::nullopt;
+                return string_view(_background_pid);
+        }
+    }
+
+    /* VARIABLES */
+    const Slot &slot = slot_for(name, hash(name));
+    if (!slot.is_set) return std::nullopt;
+    return string_view(slot.value);
+}
+
+void VarStore::set(string_view name, string_view value)
+{
+    uint32_t name_hash = hash(name);
+    Slot *slot = &slot_for(name, name_hash);
+    if (slot->name.empty()) {
+        if ((_n_used + 1) * 4 > _slots.size() * 3) {
+            grow();
+            slot = &slot_for(name, name_hash);
+        }
+        slot->name = _names.copy(name);
+        slot->hash = name_hash;
+        ++_n_used;
+    }
+    slot->is_set = true;
+    slot->value = value;
+}
+
+void VarStore::unset(string_view name)
+{
+    Slot &slot = slot_for(name, hash(name));
+    slot.is_set = false;
+    slot.value.clear();
+}
+
+void VarStore::set_positional(std::vector<string> positional)
+{
+    Positional &frame = _frames[_n_frames - 1];
+    frame.params = std::move(positional);
+    summarize(frame);
+}
+
+void VarStore::push_positional(const string_view *args, size_t n_args)
+{
+    if (_n_frames == _frames.size()) _frames.emplace_back();
+    Positional &frame = _frames[_n_frames++];
+    const Positional &outer = _frames[_n_frames - 2];
+
+    frame.params.resize(n_args + 1);
+    // assign() reuses the strings' existing capacity
+    frame.params[0].assign(outer.params.empty() ? "" : outer.params[0]);
+    for (size_t i = 0; i < n_args; ++i) {
+        frame.params[i + 1].assign(args[i].data(), args[i].size());
+    }
+    summarize(frame);
+}
+
+void VarStore::pop_positional()
+{
+    if (_n_frames > 1) --_n_frames;
+}
+
+/** $?, formatted only when the status has changed since last time. */
+string_view VarStore::status_text()
+{
+    if (_formatted_status != _status) {
+        auto result = std::to_chars(
+            _status_text, _status_text + sizeof(_status_text), _status);
+        _status_length = result.ptr - _status_text;
+        _formatted_status = _status;
+    }
+    return string_view(_status_text, _status_length);
+}
+
+void VarStore::set_pipe_status(const int *statuses, size_t n_stages)
+{
+    _pipe_status.assign(statuses, statuses + n_stages);
+    _pipe_status_formatted = false;
+}
+
+void VarStore::set_background_pid(pid_t pid)
+{
+    char text[24];
+    auto result = std::to_chars(text, text + sizeof(text), pid);
+    _background_pid.assign(text, result.ptr - text);
+}
+
+/** Compute $# and $* for a frame's parameters. */
+void VarStore::summarize(Positional &frame)
+{
+    size_t count = frame.params.empty() ? 0 : frame.params.size() - 1;
+    char text[24];
+    auto result = std::to_chars(text, text + sizeof(text), count);
+    frame.count.assign(text, result.ptr - text);
+    frame.all.clear();
+    for (size_t i = 1; i < frame.params.size(); ++i) {
+        if (i > 1) frame.all += ' ';
+        frame.all += frame.params[i];
+    }
+}
+
+/** FNV-1a. */
+uint32_t VarStore::hash(string_view name)
+{
+    uint32_t h = 2166136261u;
+    for (unsigned char c : name) {
+        h = (h ^ c) * 16777619u;
+    }
+    return h;
+}
+
+/**
+ * Returns the slot holding 'name', or the free slot where it would go.
+ */
+VarStore::Slot& VarStore::slot_for(string_view name, uint32_t hash)
+{
+    size_t mask = _slots.size() - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        Slot &slot = _slots[i];
+        if (slot.name.empty() ||
+            (slot.hash == hash && slot.name == name)) {
+            return slot;
+        }
+    }
+}
+
+/** Double the number of slots. Names stay where they are in the arena. */
+void VarStore::grow()
+{
+    std::vector<Slot> old_slots(_slots.size() * 2);
+    old_slots.swap(_slots);
+    for (Slot &old_slot : old_slots) {
+        if (old_slot.name.empty()) continue;
+        Slot &slot = slot_for(old_slot.name, old_slot.hash);
+        slot = std::move(old_slot);
+    }
+}
@@ -0,0 +1,114 @@
+#pragma once
+#include "util/arena.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <vector>
+
+/**
+ * The variables of a shell session, along with its special parameters: the
+ * exit status ($?), the statuses of the stages of the last pipeline
+ * ($PIPESTATUS), the positional parameters ($0, $1, ..., $#, $*), and the
+ * pid of the last background command ($!).
+ *
+ * Variables are kept in an open-addressing hash table (linear probing) whose
+ * slots hold views of interned names: each name is copied into an arena once,
+ * the first time it is assigned, and its slot is reused if the variable is
+ * unset and assigned again. Lookups never insert, so referencing undefined
+ * names costs no memory.
+ *
+ * The special parameters aren't stored as variables at all. The exit statuses
+ * are integers, only formatted when expanded, and the positional
+ * parameters are a vector indexed by number. Function calls push a new set of
+ * positional parameters onto a stack whose storage is kept for reuse.
+ */
+class VarStore {
+  public:
+    VarStore() : _slots(16) {}
+
+    /**
+     * Returns the value of a variable or special parameter, or nothing if it
+     * isn't set. The view is valid until the next change to the store.
+     */
+    std::optional<std::string_view> find(std::string_view name);
+
+    /** Assign a variable. 'name' must not be a special parameter. */
+    void set(std::string_view name, std::string_view value);
+
+    /** Unset a variable, if it is set. */
+    void unset(std::string_view name);
+
+    int status() const { return _status; }
+    void set_status(int status) { _status = status; }
+
+    /**
+     * Set $PIPESTATUS, the statuses of the stages of the last pipeline,
+     * separated by spaces. With no stages, it is the same as $? from then
+     * on.
+     */
+    void set_pipe_status(const int *statuses, size_t n_stages);
+
+    /** The positional parameters, starting with $0. */
+    const std::vector<std::string>& positional() const 
+    { 
+        return _frames[_n_frames - 1].params; 
+    }
+    void set_positional(std::vector<std::string> positional);
+
+    /**
+     * Make 'args' the positional parameters from $1 on ($0 is kept) until
+     * the matching pop_positional(), as for a function call. Popped 
+     * parameters leave their storage behind for the next push, so calls
+     * nested no deeper, with arguments no longer, than earlier ones allocate
+     * nothing.
+     */
+    void push_positional(const std::string_view *args, size_t n_args);
+    void pop_positional();
+
+    void set_background_pid(pid_t pid);
+
+  private:
+    struct Slot {
+        /* interned in _names; empty for a free slot */
+        std::string_view name;
+        uint32_t hash = 0;
+        bool is_set = false;
+        std::string value;
+    };
+
+    /* power-of-two number of slots, at most 3/4 of them in use */
+    std::vector<Slot> _slots;
+    size_t _n_used = 0;
+    Arena _names;
+
+    int _status = 0;
+    /* $?, formatted on demand for _formatted_status */
+    int _formatted_status = -1;
+    char _status_text[16];
+    size_t _status_length = 0;
+    /* $PIPESTATUS, if not just $?; formatted on demand */
+    std::vector<int> _pipe_status;
+    std::string _pipe_status_text;
+    bool _pipe_status_formatted = false;
+    struct Positional {
+        std::vector<std::string> params;
+        /* $# and $* (the parameters from $1 on, joined by spaces) */
+        std::string count = "0";
+        std::string all;
+    };
+    /* the script's positional parameters, then those of each function call
+       in progress; frames past _n_frames are unused */
+    std::vector<Positional> _frames {1};
+    size_t _n_frames = 1;
+    /* $!, empty until a command is run in the background */
+    std::string _background_pid;
+
+    std::string_view status_text();
+    static uint32_t hash(std::string_view name);
+    Slot& slot_for(std::string_view name, uint32_t hash);
+    void grow();
+    static void summarize(Positional &frame);
+};
@@ -0,0 +1,57 @@
+/**
+ * Benchmark for command substitution capture. Reports how fast the output
+ * of 'head -c SIZE /dev/zero' is captured, for sizes from 1 KB up to a
+ * maximum, with the output kept on the heap and with it spilled to an
+ * in-memory file past the default threshold.
+ *
+ * Usage: capture_bench [maximum size in MB, default 1024]
+ */
+#include "../Executor.h"
+#include "../loguru/loguru.hpp"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+using Clock = std::chrono::steady_clock;
+
+static void run(Executor& executor, size_t size)
+{
+    std::string command = "head -c " + std::to_string(size) + " /dev/zero";
+    /* repeat small captures so that each measurement takes a while */
+    int rounds = size >= (64 << 20) ? 1 : size >= (1 << 20) ? 20 : 200;
+
+    size_t default_threshold = Executor::Options().capture_spill_threshold;
+    for (size_t threshold : {SIZE_MAX, default_threshold}) {
+        if (threshold != SIZE_MAX && size <= threshold) continue;
+        executor.options().capture_spill_threshold = threshold;
+        auto start = Clock::now();
+        for (int i = 0; i < rounds; ++i) {
+            std::string output =
+                executor.execute_command_and_capture_output(command);
+            if (output.size() != size) {
+                std::printf("short capture: %zu of %zu bytes\n",
+                            output.size(), size);
+            }
+        }
+        double secs =
+            std::chrono::duration<double>(Clock::now() - start).count();
+        bool spills = size > threshold;
+        std::printf("  %10zu bytes  %-6s %10.3f ms %10.1f MB/s\n", size,
+                    spills ? "memfd" : "heap", secs * 1000 / rounds,
+                    size * rounds / secs / (1024 * 1024));
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    loguru::g_stderr_verbosity = loguru::Verbosity_OFF;
+    size_t max_size = (argc > 1 ? std::stoul(argv[1]) : 1024) << 20;
+
+    Executor executor;
+    std::printf("capture of 'head -c SIZE /dev/zero':\n");
+    for (size_t size : {1 << 10, 1 << 15, 1 << 20, 1 << 25, 1 << 30}) {
+        if (size <= max_size) run(executor, size);
+    }
+    return 0;
+}
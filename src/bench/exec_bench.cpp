@@ -0,0 +1,70 @@
+/**
+ * Benchmark for launching executables. Reports the average time to run
+ * a trivial program to completion, started with fork + exec, posix_spawn,
+ * and vfork + execveat from a cached O_PATH descriptor, both for /bin/true
+ * and for a copy of it at the end of a long path (where path resolution
+ * costs the most).
+ *
+ * Usage: exec_bench [number of launches, default 2000]
+ */
+#include "../Executor.h"
+#include "../loguru/loguru.hpp"
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+
+using Clock = std::chrono::steady_clock;
+namespace fs = std::filesystem;
+
+static void run(Executor& executor, const std::string& path, int launches)
+{
+    struct Mode {
+        const char* name;
+        bool posix_spawn;
+        bool execveat;
+    };
+    const Mode modes[] = {
+        {"fork", false, false},
+        {"posix_spawn", true, false},
+        {"execveat", true, true},
+    };
+
+    std::printf("%s:\n", path.c_str());
+    for (const Mode& mode : modes) {
+        executor.options().posix_spawn = mode.posix_spawn;
+        executor.options().execveat = mode.execveat;
+        executor.execute_command(path); // warm up
+        auto start = Clock::now();
+        for (int i = 0; i < launches; ++i) {
+            executor.execute_command(path);
+        }
+        double secs =
+            std::chrono::duration<double>(Clock::now() - start).count();
+        std::printf("  %-12s %10.1f us/launch\n", mode.name,
+                    secs * 1e6 / launches);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    loguru::g_stderr_verbosity = loguru::Verbosity_OFF;
+    int launches = argc > 1 ? std::stoi(argv[1]) : 2000;
+
+    /* a copy of /bin/true, 16 directories deep */
+    fs::path root = fs::temp_directory_path() / "clash_exec_bench";
+    fs::path dir = root;
+    for (int i = 0; i < 16; ++i) {
+        dir /= "directory_" + std::to_string(i);
+    }
+    fs::create_directories(dir);
+    fs::copy_file("/bin/true", dir / "true",
+                  fs::copy_options::overwrite_existing);
+
+    Executor executor;
+    run(executor, "/bin/true", launches);
+    run(executor, (dir / "true").string(), launches);
+
+    fs::remove_all(root);
+    return 0;
+}
@@ -0,0 +1,156 @@
+/**
+ * Microbenchmark for the parser's hot loops. Reports, in MB/s of script
+ * text, how fast the shell metacharacter scanner and the full parser run
+ * with the scalar scanner ("before") and with the vectorized one ("after").
+ *
+ * Usage: parse_bench [number of script lines]
+ */
+#include "../Parser.h"
+#include "../loguru/loguru.hpp"
+#include "../util/char_scan.h"
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+/* lines typical of generated batch scripts: long paths and arguments */
+static std::vector<std::string> make_script(size_t n_lines)
+{
+    std::vector<std::string> lines;
+    for (size_t i = 0; i < n_lines; ++i) {
+        std::string shard = std::to_string(i % 1000);
+        switch (i % 4) {
+            case 0:
+                lines.push_back("cp /data/warehouse/shards/input_" + shard + 
+                    ".parquet /mnt/scratch/staging/output_" + shard + 
+                    ".parquet");
+                break;
+            case 1:
+                lines.push_back("transform --config=/etc/pipeline/default.yaml"
+                    " --shard=" + shard + " --verbose > /var/log/job_" + 
+                    shard + ".log");
+                break;
+            case 2:
+                lines.push_back("echo \"processing shard " + shard + 
+                    " of the nightly export for $USER\" | tee -a progress.txt");
+                break;
+            default:
+                lines.push_back("src=/data/warehouse/shards/input_" + shard + 
+                    ".parquet; dst=/mnt/archive/2024/" + shard + 
+                    "; mv $src $dst");
+                break;
+        }
+    }
+    return lines;
+}
+
+/* lines with long unbroken arguments, e.g. encoded payloads and URLs */
+static std::vector<std::string> make_long_token_script(size_t n_lines)
+{
+    std::vector<std::string> lines;
+    for (size_t i = 0; i < n_lines; ++i) {
+        std::string token(200, 'a' + i % 26);
+        lines.push_back("upload https://storage.example.com/bucket/" + token + 
+                        " \"" + token + "\"");
+    }
+    return lines;
+}
+
+static double mb_per_sec(size_t bytes, Clock::duration elapsed)
+{
+    double secs = std::chrono::duration<double>(elapsed).count();
+    return bytes / secs / (1024 * 1024);
+}
+
+/* scan the whole script for metacharacters, like a word-splitting pass */
+static size_t scan(const std::string& text, const CharScanner& scanner)
+{
+    size_t n_found = 0;
+    for (size_t pos = scanner.find(text); pos != std::string::npos; 
+         pos = scanner.find(text, pos + 1)) {
+        ++n_found;
+    }
+    return n_found;
+}
+
+static size_t scan_find_first_of(const std::string& text, const char* chars)
+{
+    size_t n_found = 0;
+    for (size_t pos = text.find_first_of(chars); pos != std::string::npos; 
+         pos = text.find_first_of(chars, pos + 1)) {
+        ++n_found;
+    }
+    return n_found;
+}
+
+static size_t parse_all(const std::vector<std::string>& lines)
+{
+    size_t n_words = 0;
+    for (const std::string& line : lines) {
+        ast::CommandList list(line);
+        Parser(list).parse();
+        for (const ast::AndOr& and_or : list.body.items) {
+            for (const ast::Pipeline& pipeline : and_or.pipelines) {
+                for (const ast::Command& cmd : pipeline.commands) {
+                    n_words += cmd.simple.words.size();
+                }
+            }
+        }
+    }
+    return n_words;
+}
+
+static void run(const char* name, const std::vector<std::string>& lines)
+{
+    const int kRounds = 5;
+    std::string text;
+    for (const std::string& line : lines) text += line + "\n";
+    size_t bytes = text.size() * kRounds;
+    std::printf("%s script: %zu lines, %.1f MB\n", name, lines.size(), 
+                text.size() / (1024.0 * 1024));
+
+    /* metacharacters of unquoted words (see Parser.cpp) */
+    static const char* kSpecial = " \t;\n|<>\\'\"$`{}";
+    CharScanner scanner(kSpecial);
+    volatile size_t sink = 0;
+
+    auto start = Clock::now();
+    for (int i = 0; i < kRounds; ++i) {
+        sink = sink + scan_find_first_of(text, kSpecial);
+    }
+    std::printf("  %-36s %8.1f MB/s\n", "scan: std::string::find_first_of", 
+                mb_per_sec(bytes, Clock::now() - start));
+
+    for (bool simd : {false, true}) {
+        CharScanner::use_simd(simd);
+        start = Clock::now();
+        for (int i = 0; i < kRounds; ++i) sink = sink + scan(text, scanner);
+        std::string label = std::string("scan: CharScanner (") + 
+                            CharScanner::implementation_name() + ")";
+        std::printf("  %-36s %8.1f MB/s\n", label.c_str(), 
+                    mb_per_sec(bytes, Clock::now() - start));
+    }
+
+    for (bool simd : {false, true}) {
+        CharScanner::use_simd(simd);
+        start = Clock::now();
+        for (int i = 0; i < kRounds; ++i) sink = sink + parse_all(lines);
+        std::string label = std::string("parse: Parser (") + 
+                            CharScanner::implementation_name() + ")";
+        std::printf("  %-36s %8.1f MB/s\n", label.c_str(), 
+                    mb_per_sec(bytes, Clock::now() - start));
+    }
+    std::printf("\n");
+}
+
+int main(int argc, char* argv[])
+{
+    loguru::g_stderr_verbosity = loguru::Verbosity_OFF;
+    size_t n_lines = argc > 1 ? std::stoul(argv[1]) : 200000;
+
+    run("batch", make_script(n_lines));
+    run("long-token", make_long_token_script(n_lines / 4));
+    return 0;
+}
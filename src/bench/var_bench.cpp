@@ -0,0 +1,60 @@
+/**
+ * Benchmark for variable expansion. Reports the average time to execute
+ * assignment lines made up of many expansions: of variables that are set,
+ * of special parameters, and of names that are set nowhere (the same ones
+ * over and over, and a new one on every line). Also reports the peak memory
+ * use, which grows if undefined names are remembered.
+ *
+ * Usage: var_bench [number of executions per line, default 100000]
+ */
+#include "../Executor.h"
+#include "../loguru/loguru.hpp"
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <sys/resource.h>
+
+using Clock = std::chrono::steady_clock;
+
+static void run(Executor& executor, const char* name, int rounds,
+                std::string (*make_line)(int))
+{
+    auto start = Clock::now();
+    for (int i = 0; i < rounds; ++i) {
+        executor.execute_command(make_line(i));
+    }
+    double secs = std::chrono::duration<double>(Clock::now() - start).count();
+    std::printf("  %-20s %8.3f us/line\n", name, secs * 1e6 / rounds);
+}
+
+int main(int argc, char* argv[])
+{
+    loguru::g_stderr_verbosity = loguru::Verbosity_OFF;
+    int rounds = argc > 1 ? std::stoi(argv[1]) : 100000;
+
+    Executor executor;
+    executor.execute_command("first=alpha; second=beta; third=gamma");
+
+    std::printf("expansion-heavy assignment lines:\n");
+    run(executor, "set variables", rounds, [](int) -> std::string {
+        return "x=$first$second$third$first$second$third$first$second";
+    });
+    run(executor, "special parameters", rounds, [](int) -> std::string {
+        return "x=$?$#$?$#$?$#$?$#";
+    });
+    run(executor, "unset variables", rounds, [](int) -> std::string {
+        return "x=$none1$none2$none3$none4$none5$none6$none7$none8";
+    });
+    /* distinct lines also miss the parse cache; compare with the next */
+    run(executor, "new unset name", rounds, [](int i) -> std::string {
+        return "x=$none_" + std::to_string(i);
+    });
+    run(executor, "new literal", rounds, [](int i) -> std::string {
+        return "x=none_" + std::to_string(i);
+    });
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    std::printf("peak memory: %ld KB\n", usage.ru_maxrss);
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include "ExecutorTestHarness.h"
 #include "../loguru/loguru.hpp"
+#include <cstdlib>
 #include <iostream>
 
 int main(int argc, char* argv[])
@@ -9,6 +10,12 @@ int main(int argc, char* argv[])
     // loguru::add_file("clash.log", loguru::Truncate, loguru::Verbosity_MAX);
     loguru::g_stderr_verbosity = loguru::Verbosity_OFF; // disable logging
 
+    /* for the environment import tests */
+    setenv("CLASH_TEST_INHERITED", "inherited", 1);
+    /* for the job slot tests */
+    setenv("CLASH_MAX_JOBS", "2", 1);
+    /* for the tests of 'clash -j' */
+    setenv("CLASH", CLASH_BINARY, 1);
     ExecutorTestHarness tests;
 
     /* SPEC TESTS */ 
@@ -75,6 +82,85 @@ int main(int argc, char* argv[])
     tests.add_test("", "");
     tests.add_test("words.py", "");
 
+    // parsing
+    tests.add_test("x='a > b'; words.py $x", "$1: a\n$2: >\n$3: b\n");
+    tests.add_test("x='a  b'; y=$x; words.py \"$y\"", "$1: a  b\n");
+    tests.add_test("echo abc | cat | cat", "abc\n");
+    tests.add_test("x=abc; words.py 0123456789012345678901234567890123456789"
+                   "\"in quotes: 0123456789012345678901234567890123456789\"$x",
+                   "$1: 0123456789012345678901234567890123456789"
+                   "in quotes: 0123456789012345678901234567890123456789abc\n");
+    tests.add_test("x=ab; echo $x\u00e9 ${x}\u00e9", "ab\u00e9 ab\u00e9\n");
+    tests.add_test("echo 'abc", "Unterminated single quotes");
+    tests.add_test("echo abc |", "Incomplete pipeline");
+    tests.add_test("echo > | cat", "missing output file name");
+
+    // parse cache: repeated lines see current variable values
+    tests.add_test("x=first", "");
+    tests.add_test("words.py $x `echo $x`", "$1: first\n$2: first\n");
+    tests.add_test("x=second", "");
+    tests.add_test("words.py $x `echo $x`", "$1: second\n$2: second\n");
+
+    // large command substitutions (more than a pipe buffer)
+    std::string seq_output;
+    for (int i = 1; i <= 20000; ++i) seq_output += std::to_string(i) + "\n";
+    tests.add_test("seq 20000", seq_output);
+    tests.add_test("printf %s `seq 20000` | wc -c", "88894\n");
+
+    // nested command substitutions, each capturing into its own pipe
+    tests.add_test("echo `echo a \\`echo b | cat\\` c` d", "a b c d\n");
+    tests.add_test("echo `echo inner > trash_file`; cat trash_file", 
+                   "\ninner\n");
+
+    // parallel command substitutions
+    // (1s, not 3s)
+    tests.add_test("t0=`date +%s%N`; words.py"
+                   " `sleep 1; echo a` `sleep 1; echo b` `sleep 1; echo c`;"
+                   " t1=`date +%s%N`; echo $(((t1 - t0) / 1000000000 < 2))",
+                   "$1: a\n$2: b\n$3: c\n1\n");
+    tests.add_test("echo `echo a` `cat < fakefile`", 
+                   "No such file or directory");
+    tests.add_test("x=`true` y=`false`; echo $?", "1\n");
+    tests.add_test("rm -f trash_file; echo ${x:-`echo c`}"
+                   " `sh -c 'echo a >> trash_file'`"
+                   " `sh -c 'echo b >> trash_file'`; sort trash_file",
+                   "c\na\nb\n");
+    tests.add_test("set +o parallel_substitutions; echo `x=seq` `echo $x`;"
+                   "set -o parallel_substitutions", "seq\n");
+    // side effects of substitutions don't survive them, however many
+    tests.add_test("d=`pwd`; x=1; echo `cd /; x=2`; [ `pwd` = $d ] && echo $x;"
+                   " echo `cd /` `x=2`; [ `pwd` = $d ] && echo $x;"
+                   " set +o parallel_substitutions; echo `cd /; x=3`; pwd;"
+                   " echo $x; cd $d; set -o parallel_substitutions",
+                   "\n1\n\n1\n\n/\n3\n");
+
+    // PATH lookup: directories are searched in order, and the index notices
+    // changes to PATH and to the directories
+    tests.add_test("mkdir -p /tmp/clash_path_a /tmp/clash_path_b;"
+                   "printf '#!/bin/sh\\necho a\\n' > /tmp/clash_path_a/tool;"
+                   "printf '#!/bin/sh\\necho b\\n' > /tmp/clash_path_b/tool;"
+                   "chmod +x /tmp/clash_path_a/tool /tmp/clash_path_b/tool", "");
+    tests.add_test("p=$PATH; PATH=/tmp/clash_path_b:/tmp/clash_path_a:$p; tool;"
+                   "PATH=/tmp/clash_path_a:/tmp/clash_path_b:$p; tool; PATH=$p",
+                   "b\na\n");
+    tests.add_test("p=$PATH; PATH=/tmp/clash_path_a:$p; tool;"
+                   "printf '#!/bin/sh\\necho new\\n' > /tmp/clash_path_a/new;"
+                   "chmod +x /tmp/clash_path_a/new; new; PATH=$p", "a\nnew\n");
+    tests.add_test("p=$PATH; PATH=/tmp/clash_path_a; hash -r; hash tool; tool;"
+                   "hash; PATH=$p", 
+                   "a\nhits\tcommand\n   2\t/tmp/clash_path_a/tool\n");
+    tests.add_test("hash -r; hash", "hash: hash table empty\n");
+    tests.add_test("hash nonexistent_tool", "hash: nonexistent_tool: not found");
+    tests.add_test("p=$PATH; d=`pwd`; PATH=.:/tmp/clash_path_a:$p;"
+                   "cd /tmp/clash_path_b; tool; cd /; tool; cd $d; PATH=$p",
+                   "b\na\n");
+    tests.add_test("rm -r /tmp/clash_path_a /tmp/clash_path_b", "");
+    tests.add_test("clash_notyet", "command not found: clash_notyet");
+    tests.add_test("clash_notyet", "command not found: clash_notyet");
+    tests.add_test("printf '#!/bin/sh\\necho found\\n' > clash_notyet;"
+                   "chmod +x clash_notyet; clash_notyet; rm clash_notyet", 
+                   "found\n");
+
     // file redirection
     tests.add_test("echo pizza > trash_file; cat trash_file", "pizza\n");
     tests.add_test("cat < trash_file", "pizza\n");
@@ -86,6 +172,36 @@ int main(int argc, char* argv[])
                    "sleep 1 | sleep 1 | sleep 1 | sleep 1 | sleep 1", 
                    "this should take 1s, not 10s\n");
 
+    // spawn backends
+    tests.add_test("set +o posix_spawn; echo forked | cat; set -o posix_spawn;"
+                   "echo spawned | cat", "forked\nspawned\n");
+    tests.add_test("set +o execveat; echo by path | cat; set -o execveat;"
+                   "echo by fd | cat; echo again | cat",
+                   "by path\nby fd\nagain\n");
+    tests.add_test("printf '#!/bin/sh\\necho script\\n' > zfoo.txt;"
+                   "chmod +x zfoo.txt; ./zfoo.txt; ./zfoo.txt",
+                   "script\nscript\n");
+    tests.add_test("set -o", "posix_spawn\ton\nexecveat\ton\nbuiltin_utils\ton\n"
+                   "parallel_substitutions\ton\njobserver\ton\n"
+                   "pipefail\toff\n");
+    tests.add_test("set -o fakeoption", "set: fakeoption: invalid option name");
+
+    // utility builtins
+    tests.add_test("echo -n x; echo y", "xy\n");
+    tests.add_test("echo -e 'a\\tb'", "a\tb\n");
+    tests.add_test("printf '%s-%03d\\n' a 7 b 12", "a-007\nb-012\n");
+    tests.add_test("printf '%x %c %.2f' 255 zed 3.14159", "ff z 3.14");
+    tests.add_test("true; echo $?; false; echo $?", "0\n1\n");
+    tests.add_test("true | false; echo $? $#; x=1; unset x; echo [$x$*]",
+                   "1 0\n[]\n");
+    tests.add_test("[ 1 -lt 2 ]; echo $?; test -z abc; echo $?", "0\n1\n");
+    tests.add_test("[ ! -d src -o abc = abc ]; echo $?", "0\n");
+    tests.add_test("[ 1 -eq 1; echo $?", "2\n");
+    tests.add_test("echo builtin > trash_file; cat trash_file", "builtin\n");
+    tests.add_test("echo piped | cat", "piped\n");
+    tests.add_test("set +o builtin_utils; echo external; set -o builtin_utils",
+                   "external\n");
+
     // built-ins error handling
     tests.add_test("cd fakedirectory", 
                    "cd: fakedirectory: No such file or directory");
@@ -93,6 +209,127 @@ int main(int argc, char* argv[])
                    "exit: fakestatus: numeric argument required");
     tests.add_test("export fakevar", "");
     tests.add_test("unset fakevar", "");
+    tests.add_test("x=1; export x; printenv x; x=2; printenv x; unset x;"
+                   "printenv x; echo $?", "1\n2\n1\n");
+    tests.add_test("export y=exported; x=local printenv x y; echo [$x]",
+                   "local\nexported\n[]\n");
+    tests.add_test("x=a x=b printenv x", "b\n");
+    // arithmetic expansion
+    tests.add_test("echo $((1 + 2 * 3)) $(( (1+2)*3 )) $((7/2)) $((-7%3))"
+                   " \"$((2**10 >> 1))\"", "7 9 3 -1 512\n");
+    tests.add_test("i=0; i=$((i+1)); echo $((i += 5)) $i $((i++)) $i $((--i))",
+                   "6 6 6 7 6\n");
+    tests.add_test("x=y; y=4; echo $((x*2)) $((0 && 1/0)) $((2>1 ? 10 : 20))"
+                   " $((0x10 + 010)) $(($y<<2))", "8 0 10 24 16\n");
+    tests.add_test("echo $((1/0))", "arithmetic: division by 0");
+    tests.add_test("echo $((1 +))", "arithmetic: syntax error in '1 +'");
+    // parameter expansion operators
+    tests.add_test("f=/usr/lib/libz.so.1; echo ${f##*/} ${f%/*} ${f#*.}"
+                   " ${f%%.*} ${#f} ${f:5:3} ${f: -4} ${f:1:-9}",
+                   "libz.so.1 /usr/lib so.1 /usr/lib/libz 18 lib so.1 "
+                   "usr/lib/\n");
+    tests.add_test("f=a.b.a; p='*a'; echo ${f/a/X} ${f//a/X} ${f//[!.]/-}"
+                   " ${f/#a/X} ${f/%a/X} ${f#$p} ${f#\"$p\"}",
+                   "X.b.a X.b.X -.-.- X.b.a a.b.X .b.a a.b.a\n");
+    tests.add_test("echo ${unset_var:-\"default $CLASH_TEST_INHERITED\"}"
+                   " ${f:-x}", "default inherited a.b.a\n");
+    tests.add_test("echo ${f", "Unterminated braces for variable name");
+    tests.add_test("echo $CLASH_TEST_INHERITED; unset CLASH_TEST_INHERITED;"
+                   "echo [$CLASH_TEST_INHERITED]", "inherited\n[]\n");
+    // control flow
+    tests.add_test("for i in a 'b c'; do echo $i; done;"
+                   " for x; do echo $x; done", "a\nb c\n");
+    tests.add_test("i=0; while [ $i -lt 3 ]; do i=$((i+1)); echo $i; done;"
+                   "until true; do echo no; done; echo $?", "1\n2\n3\n0\n");
+    tests.add_test("if false; then echo a; elif true; then echo b; else echo c;"
+                   " fi; if false; then echo d; fi; echo $?", "b\n0\n");
+    tests.add_test("for f in a.txt b.c d; do case $f in *.txt) echo t;;"
+                   " *.c|*.h) echo c;; *) echo $f; esac; done", "t\nc\nd\n");
+    tests.add_test("true && echo a || echo b; false && echo c || echo d;"
+                   " ! true; echo $?", "a\nd\n1\n");
+    tests.add_test("for i in 1 2 3; do for j in 1 2 3; do"
+                   " if [ $j = 2 ]; then continue; fi;"
+                   " if [ $i = 3 ]; then break 2; fi; echo $i$j; done; done",
+                   "11\n13\n21\n23\n");
+    tests.add_test("{ echo a; echo b; } | while true; do cat; break; done",
+                   "a\nb\n");
+    tests.add_test("{ echo hi; echo there; } > trash_file; i=0;"
+                   " while [ $i -lt 2 ]; do head -n 1; i=$((i+1)); done"
+                   " < trash_file; if true; then cat; fi <trash_file | wc -l;"
+                   " for i in 1; do echo $i; done > trash_file >zfoo.txt;"
+                   " cat trash_file zfoo.txt", "hi\nthere\n2\n1\n");
+    tests.add_test("{ echo hi; } >", "missing output file name");
+    tests.add_test("if true; then echo a", "syntax error: missing 'fi'");
+    tests.add_test("echo a; fi", "syntax error near unexpected token 'fi'");
+    // functions
+    tests.add_test("f() { echo \"$# [$*] $2\"; }; f a 'b c'; f; echo $#",
+                   "2 [a b c] b c\n0 [] \n0\n");
+    tests.add_test("fact() { if [ $1 -le 1 ]; then echo 1; return; fi;"
+                   " r=`fact $(($1 - 1))`; echo $(($1 * r)); }; fact 10",
+                   "3628800\n");
+    tests.add_test("f() { for i in 1 2 3; do if [ $i = 2 ]; then return 7;"
+                   " fi; echo $i; done; }; for j in a b; do f; echo $?; done",
+                   "1\n7\n1\n7\n");
+    tests.add_test("f() { echo in f; }; f | cat; f > trash_file; unset -f f;"
+                   " cat trash_file", "in f\nin f\n");
+    tests.add_test("f() { echo $1; } > trash_file; f a; f b | cat;"
+                   " cat trash_file; unset -f f", "b\n");
+    tests.add_test("f() { echo \"X=$X\"; sh -c 'echo $X'; }; X=1 f; X=2;"
+                   " X=3 X=4 f | cat; echo $X; unset X; X=5 parallel sh -c"
+                   " 'echo $X $1' sh ::: a; echo [$X]; unset -f f",
+                   "X=1\n1\nX=4\n4\n2\n5 a\n[]\n");
+    tests.add_test("return", "return: can only return from a function");
+    // background jobs
+    tests.add_test("echo bg > trash_file & wait; cat trash_file;"
+                   " true && echo andor & wait", "bg\nandor\n");
+    tests.add_test("false & sleep 0.05 & wait %1; echo $?; ! true & wait $!;"
+                   " echo $?; wait; wait %5; echo $?", "1\n1\n127\n");
+    tests.add_test("bg_var=1 & wait; echo [$bg_var]", "[]\n");
+    tests.add_test("sleep 0.2 & jobs; wait",
+                   "[1]  Running                 sleep 0.2 &\n");
+    tests.add_test("sleep 0.05 & sleep 0.3 & sleep 0.3 & jobs; wait",
+                   "[1]  Done                    sleep 0.05 &\n"
+                   "[2]  Running                 sleep 0.3 &\n"
+                   "[3]  Running                 sleep 0.3 &\n");
+    tests.add_test("parallel -k -j 2 echo n ::: 1 2 3; printf 'a\\nb\\n' |"
+                   " parallel -k echo {}{} x", "n 1\nn 2\nn 3\naa x\nbb x\n");
+    tests.add_test("parallel -j 2 sh -c 'exit $1' sh ::: 0 3 4; echo $?",
+                   "2\n");
+    tests.add_test("set +o builtin_utils; parallel -k echo ::: a b | cat;"
+                   " set -o builtin_utils", "a\nb\n");
+    // jobs still running when the shell exits return their tokens
+    tests.add_test("rm -f /tmp/clash_fifo; mkfifo /tmp/clash_fifo;"
+                   " sh -c 'exec 3<>/tmp/clash_fifo; printf xyz >&3;"
+                   " export CLASH_MAX_JOBS=8"
+                   " MAKEFLAGS=\"-j4 --jobserver-auth=fifo:/tmp/clash_fifo\";"
+                   " j=\"sleep 0.2 & sleep 0.2 & sleep 0.2 &\";"
+                   " $CLASH -c \"$j exit\"; $CLASH -c \"$j true\";"
+                   " dd bs=8 count=1 iflag=nonblock <&3 2>/dev/null | wc -c';"
+                   " rm /tmp/clash_fifo", "3\n");
+
+    // clash -j: ordered output, barriers, failures
+    tests.add_test("printf '%s\\n' x=shared '' 'sleep 0.2; echo one $x'"
+                   " 'echo two; false' wait 'echo three' > zfoo.txt;"
+                   " sh -c '$CLASH -j 2 zfoo.txt 2>&1'; echo $?",
+                   "one shared\ntwo\nclash: line 4: exit status 1\nthree\n"
+                   "clash: 1 of 4 commands failed\n1\n");
+    // running out of descriptors stops starting commands
+    tests.add_test("printf 'echo %s\\n' 1 2 3 4 5 6 7 8 > zfoo.txt; sh -c"
+                   " 'ulimit -n 16; $CLASH -j 8 zfoo.txt > trash_file 2>&1;"
+                   " [ $? -ne 0 ] && echo failed'; grep -c 'pipe: Too many'"
+                   " trash_file; grep -c ' of 8 commands failed' trash_file",
+                   "failed\n1\n1\n");
+    tests.add_test("printf '%s\\n' 'sleep 0.2; echo late > trash_file' true"
+                   " '' 'cat trash_file' > zfoo.txt; $CLASH -j 2 zfoo.txt",
+                   "late\n");
+
+    // pipeline statuses
+    tests.add_test("false | true | sh -c 'exit 3' | true; echo $? $PIPESTATUS;"
+                   " echo $PIPESTATUS", "0 1 0 3 0\n0\n");
+    tests.add_test("set -o pipefail; false | true; echo $?; ! true | false;"
+                   " echo $? $PIPESTATUS; set +o pipefail; false | true;"
+                   " echo $?; sh -c 'kill -9 $$'; echo $?",
+                   "1\n0 0 1\n0\n137\n");
 
     tests.run_all_tests();
 }
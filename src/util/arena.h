@@ -0,0 +1,123 @@
+#pragma once
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <vector>
+
+/**
+ * A bump allocator. Allocations are carved sequentially out of large blocks
+ * and are never freed individually; instead, reset() releases everything at
+ * once while keeping the blocks around, so that an arena which is reset
+ * between units of work stops calling malloc after warming up.
+ *
+ * Strings copied into an arena are always null-terminated, so their views
+ * can be handed directly to C APIs such as execv() and open().
+ */
+class Arena {
+  public:
+    Arena(size_t block_size = 4096) : _block_size(block_size) {}
+    ~Arena() { for (Block& block : _blocks) std::free(block.data); }
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    /**
+     * Returns uninitialized memory for 'size' bytes, aligned to 'align'
+     * (which must be a power of two).
+     */
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+        while (_current < _blocks.size()) {
+            Block& block = _blocks[_current];
+            size_t offset = (_offset + align - 1) & ~(align - 1);
+            if (offset + size <= block.size) {
+                _offset = offset + size;
+                return block.data + offset;
+            }
+            ++_current;
+            _offset = 0;
+        }
+
+        /* out of space: add a new block, big enough for oversized requests */
+        size_t block_size = size + align > _block_size ? size + align
+                                                       : _block_size;
+        char* data = static_cast<char*>(std::malloc(block_size));
+        if (!data) throw std::bad_alloc();
+        _blocks.push_back(Block{data, block_size});
+        _current = _blocks.size() - 1;
+        _offset = 0;
+        return allocate(size, align);
+    }
+
+    /** Copy a string into the arena, returning a null-terminated view. */
+    std::string_view copy(std::string_view str) {
+        char* data = static_cast<char*>(allocate(str.size() + 1, 1));
+        std::memcpy(data, str.data(), str.size());
+        data[str.size()] = '\0';
+        return {data, str.size()};
+    }
+
+    /** Concatenate two strings into the arena (null-terminated). */
+    std::string_view concat(std::string_view a, std::string_view b) {
+        char* data = static_cast<char*>(allocate(a.size() + b.size() + 1, 1));
+        std::memcpy(data, a.data(), a.size());
+        std::memcpy(data + a.size(), b.data(), b.size());
+        data[a.size() + b.size()] = '\0';
+        return {data, a.size() + b.size()};
+    }
+
+    /**
+     * Release every allocation. Regular blocks are kept for reuse; oversized
+     * ones are freed so that a single huge command doesn't pin its memory.
+     */
+    void reset() {
+        size_t kept = 0;
+        for (Block& block : _blocks) {
+            if (block.size > _block_size) std::free(block.data);
+            else _blocks[kept++] = block;
+        }
+        _blocks.resize(kept);
+        _current = 0;
+        _offset = 0;
+    }
+
+  private:
+    struct Block {
+        char* data;
+        size_t size;
+    };
+
+    size_t _block_size;
+    std::vector<Block> _blocks;
+    size_t _current = 0; // index of the block being carved
+    size_t _offset = 0;  // first free byte in the current block
+};
+
+/**
+ * A standard allocator that draws from an Arena, for containers whose
+ * lifetime ends before the arena is reset. Deallocation is a no-op.
+ */
+template <typename T>
+struct ArenaAllocator {
+    using value_type = T;
+
+    ArenaAllocator(Arena& arena) : arena(&arena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T*, size_t) {}
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const {
+        return arena == other.arena;
+    }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const {
+        return arena != other.arena;
+    }
+
+    Arena* arena;
+};
@@ -0,0 +1,157 @@
+#include "capture_buffer.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using std::string_view;
+
+namespace {
+    const size_t kInitialCapacity = 4096;
+    /* most bytes moved per splice once spilled */
+    const size_t kSpillChunk = 1 << 20;
+
+    /* an anonymous file for spilled output, or -1 */
+    int create_spill_file()
+    {
+#ifdef __linux__
+        int fd = memfd_create("clash-capture", MFD_CLOEXEC);
+        if (fd != -1) return fd;
+#endif
+        const char *tmpdir = getenv("TMPDIR");
+        std::string path = std::string(tmpdir ? tmpdir : "/tmp") +
+                           "/clash-capture-XXXXXX";
+        int tmp_fd = mkstemp(&path[0]);
+        if (tmp_fd == -1) return -1;
+        unlink(path.c_str());
+        fcntl(tmp_fd, F_SETFD, FD_CLOEXEC);
+        return tmp_fd;
+    }
+
+    bool write_all(int fd, const char *data, size_t len)
+    {
+        while (len > 0) {
+            ssize_t n_written = write(fd, data, len);
+            if (n_written == -1) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += n_written;
+            len -= n_written;
+        }
+        return true;
+    }
+}
+
+CaptureBuffer::~CaptureBuffer()
+{
+    unmap();
+    if (_spill_fd != -1) close(_spill_fd);
+    std::free(_data);
+}
+
+bool CaptureBuffer::drain(int fd)
+{
+    for (;;) {
+        ssize_t n_read = fill(fd);
+        if (n_read == 0) return true;
+        if (n_read == -1 && errno != EINTR) return false;
+    }
+}
+
+ssize_t CaptureBuffer::fill(int fd)
+{
+    unmap();
+    if (!spilled() && _size == _capacity) {
+        if (_size >= _spill_threshold) {
+            if (!spill()) return -1;
+        }
+        else {
+            size_t capacity = std::min(
+                _capacity ? 2 * _capacity : kInitialCapacity, _spill_threshold);
+            char *data = static_cast<char*>(std::realloc(_data, capacity));
+            if (!data) {
+                errno = ENOMEM;
+                return -1;
+            }
+            _data = data;
+            _capacity = capacity;
+        }
+    }
+
+    ssize_t n_read;
+    if (!spilled()) {
+        n_read = read(fd, _data + _size, _capacity - _size);
+    }
+    else {
+        n_read = fill_spill_file(fd);
+    }
+    if (n_read > 0) _size += n_read;
+    return n_read;
+}
+
+/**
+ * Move the heap contents into a new spill file, and release the heap buffer.
+ */
+bool CaptureBuffer::spill()
+{
+    _spill_fd = create_spill_file();
+    if (_spill_fd == -1) return false;
+    if (!write_all(_spill_fd, _data, _size)) return false;
+    std::free(_data);
+    _data = nullptr;
+    _capacity = 0;
+    return true;
+}
+
+/**
+ * Append one read's worth of 'fd' to the spill file. On Linux the data is
+ * spliced straight from the pipe into the file, without passing through
+ * user space.
+ *
+ * @return The number of bytes moved, 0 at end-of-file, or -1 on error.
+ */
+ssize_t CaptureBuffer::fill_spill_file(int fd)
+{
+#ifdef __linux__
+    if (_can_splice) {
+        loff_t offset = _size;
+        ssize_t n_moved = splice(fd, nullptr, _spill_fd, &offset, kSpillChunk,
+                                 SPLICE_F_MOVE);
+        if (n_moved != -1 || errno != EINVAL) return n_moved;
+        _can_splice = false; // not a pipe; copy instead
+    }
+#endif
+    char chunk[1 << 16];
+    ssize_t n_read = read(fd, chunk, sizeof(chunk));
+    if (n_read > 0 && pwrite(_spill_fd, chunk, n_read, _size) != n_read) {
+        return -1;
+    }
+    return n_read;
+}
+
+string_view CaptureBuffer::view()
+{
+    if (!spilled()) return {_data, _size};
+    if (_size == 0) return {};
+    if (!_mapping) {
+        void *mapping = mmap(nullptr, _size, PROT_READ, MAP_SHARED, _spill_fd,
+                             0);
+        if (mapping == MAP_FAILED) throw std::bad_alloc();
+        _mapping = mapping;
+        _mapping_size = _size;
+    }
+    return {static_cast<const char*>(_mapping), _size};
+}
+
+void CaptureBuffer::unmap()
+{
+    if (_mapping) munmap(_mapping, _mapping_size);
+    _mapping = nullptr;
+    _mapping_size = 0;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstddef>
+#include <string_view>
+#include <sys/types.h>
+
+/**
+ * Accumulates everything read from a file descriptor (the read end of a
+ * command substitution's pipe) until end-of-file.
+ *
+ * Output is kept in a heap buffer that doubles in size as it fills, so a
+ * capture of n bytes costs O(n) copying no matter how it arrives. Once the
+ * output grows beyond the spill threshold it is moved to an anonymous
+ * in-memory file (memfd_create on Linux, an unlinked temporary file
+ * elsewhere), which later reads append to directly and which is mapped
+ * into memory when the contents are needed.
+ */
+class CaptureBuffer {
+  public:
+    /** @param spill_threshold Largest size, in bytes, kept on the heap. */
+    CaptureBuffer(size_t spill_threshold) : _spill_threshold(spill_threshold) {}
+    ~CaptureBuffer();
+    CaptureBuffer(const CaptureBuffer&) = delete;
+    CaptureBuffer& operator=(const CaptureBuffer&) = delete;
+
+    /**
+     * Read from 'fd' until end-of-file, appending to the buffer. Blocks while
+     * the writers are still running.
+     *
+     * @return 'false' if reading (or spilling) failed; the contents read so
+     *         far are kept.
+     */
+    bool drain(int fd);
+
+    /**
+     * Append the result of a single read from 'fd' to the buffer, for
+     * callers that wait on several descriptors at once.
+     *
+     * @return The number of bytes read, 0 at end-of-file, or -1 on error
+     *         (see errno).
+     */
+    ssize_t fill(int fd);
+
+    /**
+     * The captured bytes. Valid until the buffer is destroyed or filled
+     * again.
+     *
+     * @throws std::bad_alloc if spilled output cannot be mapped.
+     */
+    std::string_view view();
+
+    size_t size() const { return _size; }
+    bool spilled() const { return _spill_fd != -1; }
+
+  private:
+    size_t _spill_threshold;
+    char *_data = nullptr;
+    size_t _capacity = 0;
+    size_t _size = 0;
+    /* the in-memory file holding the output once it outgrows the heap */
+    int _spill_fd = -1;
+    /* false once splice() has failed for the descriptor being read */
+    bool _can_splice = true;
+    void *_mapping = nullptr;
+    size_t _mapping_size = 0;
+
+    bool spill();
+    ssize_t fill_spill_file(int fd);
+    void unmap();
+};
@@ -0,0 +1,184 @@
+#include "char_scan.h"
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CHAR_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+using std::string_view;
+
+namespace {
+    enum class Impl { Scalar, SSE2, AVX2 };
+
+    /* the best implementation this CPU supports, detected once */
+    Impl detect_best() {
+#ifdef CHAR_SCAN_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return Impl::AVX2;
+        if (__builtin_cpu_supports("sse2")) return Impl::SSE2;
+#endif
+        return Impl::Scalar;
+    }
+
+    const Impl kBestImpl = detect_best();
+    Impl g_impl = kBestImpl;
+}
+
+CharScanner::CharScanner(string_view chars)
+{
+    if (chars.size() > kMaxChars) {
+        throw std::invalid_argument("CharScanner: too many characters");
+    }
+    for (char c : chars) {
+        if (_table[static_cast<unsigned char>(c)]) continue;
+        _table[static_cast<unsigned char>(c)] = true;
+        std::memset(_needles[_n_chars], c, 16);
+        _chars[_n_chars++] = c;
+    }
+
+    /* assign one bit per distinct high nibble */
+    int n_high_nibbles = 0;
+    for (size_t i = 0; i < _n_chars; ++i) {
+        unsigned char c = _chars[i];
+        uint8_t& high_bit = _high_nibble_bits[c >> 4];
+        if (!high_bit) {
+            if (n_high_nibbles == 8) return;
+            high_bit = 1 << n_high_nibbles++;
+        }
+        _low_nibble_bits[c & 0xf] |= high_bit;
+    }
+    for (int i = 0; i < 16; ++i) {
+        _low_nibble_bits[i + 16] = _low_nibble_bits[i];
+        _high_nibble_bits[i + 16] = _high_nibble_bits[i];
+    }
+    _has_nibble_tables = true;
+}
+
+void CharScanner::use_simd(bool enabled)
+{
+    g_impl = enabled ? kBestImpl : Impl::Scalar;
+}
+
+const char* CharScanner::implementation_name()
+{
+    switch (g_impl) {
+        case Impl::AVX2: return "avx2";
+        case Impl::SSE2: return "sse2";
+        default: return "scalar";
+    }
+}
+
+size_t CharScanner::find(string_view text, size_t pos) const
+{
+    switch (g_impl) {
+        case Impl::AVX2: return find_avx2(text.data(), text.size(), pos);
+        case Impl::SSE2: return find_sse2(text.data(), text.size(), pos);
+        default: return find_scalar(text.data(), text.size(), pos);
+    }
+}
+
+size_t CharScanner::find_scalar(const char* data, size_t len, size_t pos) const
+{
+    for (; pos < len; ++pos) {
+        if (_table[static_cast<unsigned char>(data[pos])]) return pos;
+    }
+    return string_view::npos;
+}
+
+#ifdef CHAR_SCAN_X86
+
+/* 
+ * Both vector implementations handle a tail shorter than a full vector by
+ * re-reading the last full vector of the text and ignoring the bytes that
+ * were already checked; only texts shorter than one vector fall back to the
+ * scalar loop.
+ */
+
+/* bitmask of the bytes of data[at, at + 16) that are in the set */
+__attribute__((target("sse2")))
+static inline unsigned match_mask_sse2(const char* data, size_t at,
+                                       const char (*needles)[16], 
+                                       size_t n_chars)
+{
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + at));
+    __m128i hits = _mm_setzero_si128();
+    for (size_t i = 0; i < n_chars; ++i) {
+        __m128i needle = 
+            _mm_load_si128(reinterpret_cast<const __m128i*>(needles[i]));
+        hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, needle));
+    }
+    return static_cast<unsigned>(_mm_movemask_epi8(hits));
+}
+
+/* bitmask of the bytes of data[at, at + 32) that are in the set */
+__attribute__((target("avx2")))
+static inline unsigned match_mask_avx2(const char* data, size_t at,
+                                       const uint8_t* low_nibble_bits,
+                                       const uint8_t* high_nibble_bits)
+{
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    __m256i low_table = _mm256_load_si256(
+        reinterpret_cast<const __m256i*>(low_nibble_bits));
+    __m256i high_table = _mm256_load_si256(
+        reinterpret_cast<const __m256i*>(high_nibble_bits));
+
+    __m256i block =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + at));
+    __m256i low = _mm256_and_si256(block, low_mask);
+    __m256i high = _mm256_and_si256(_mm256_srli_epi16(block, 4), low_mask);
+    __m256i bits = _mm256_and_si256(_mm256_shuffle_epi8(low_table, low),
+                                    _mm256_shuffle_epi8(high_table, high));
+    __m256i misses = _mm256_cmpeq_epi8(bits, _mm256_setzero_si256());
+    return ~static_cast<unsigned>(_mm256_movemask_epi8(misses));
+}
+
+size_t CharScanner::find_sse2(const char* data, size_t len, size_t pos) const
+{
+    if (len < 16 || pos >= len) return find_scalar(data, len, pos);
+    for (; pos + 16 <= len; pos += 16) {
+        unsigned mask = match_mask_sse2(data, pos, _needles, _n_chars);
+        if (mask) return pos + __builtin_ctz(mask);
+    }
+    if (pos < len) {
+        unsigned mask = match_mask_sse2(data, len - 16, _needles, _n_chars) 
+                        >> (16 - (len - pos));
+        if (mask) return pos + __builtin_ctz(mask);
+    }
+    return string_view::npos;
+}
+
+__attribute__((target("avx2")))
+size_t CharScanner::find_avx2(const char* data, size_t len, size_t pos) const
+{
+    if (!_has_nibble_tables || len < 32 || pos >= len) {
+        return find_sse2(data, len, pos);
+    }
+    for (; pos + 32 <= len; pos += 32) {
+        unsigned mask = match_mask_avx2(data, pos, _low_nibble_bits, 
+                                        _high_nibble_bits);
+        if (mask) return pos + __builtin_ctz(mask);
+    }
+    if (pos < len) {
+        unsigned mask = match_mask_avx2(data, len - 32, _low_nibble_bits, 
+                                        _high_nibble_bits) 
+                        >> (32 - (len - pos));
+        if (mask) return pos + __builtin_ctz(mask);
+    }
+    return string_view::npos;
+}
+
+#else
+
+size_t CharScanner::find_sse2(const char* data, size_t len, size_t pos) const
+{
+    return find_scalar(data, len, pos);
+}
+
+size_t CharScanner::find_avx2(const char* data, size_t len, size_t pos) const
+{
+    return find_scalar(data, len, pos);
+}
+
+#endif
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/**
+ * Finds the next occurrence of any of a small set of characters, 16 or 32
+ * bytes at a time where the CPU allows it (SSE2/AVX2, chosen at runtime),
+ * and one byte at a time otherwise.
+ *
+ * The parser uses this to skip over runs of ordinary word characters, which
+ * make up most of any script, instead of switching on every byte.
+ */
+class CharScanner {
+  public:
+    /** @param chars The characters to search for; at most 16. */
+    CharScanner(std::string_view chars);
+
+    /**
+     * Returns the index of the first character in 'text' at or after 'pos'
+     * that belongs to the set, or std::string_view::npos if there is none.
+     */
+    size_t find(std::string_view text, size_t pos = 0) const;
+
+    /**
+     * Enable or disable the vectorized implementations (they are enabled by
+     * default when supported). Meant for benchmarks and tests.
+     */
+    static void use_simd(bool enabled);
+    static const char* implementation_name();
+
+    static const size_t kMaxChars = 16;
+
+  private:
+    char _chars[kMaxChars];
+    size_t _n_chars = 0;
+    bool _table[256] = {};
+
+    /* each character, repeated across a 16-byte vector (SSE2) */
+    alignas(16) char _needles[kMaxChars][16];
+    /* nibble lookup tables (AVX2): c is in the set iff 
+       _low_nibble_bits[c & 0xf] & _high_nibble_bits[c >> 4] is nonzero. Each
+       table is repeated for both 128-bit lanes. Usable when the characters
+       have at most 8 distinct high nibbles. */
+    alignas(32) uint8_t _low_nibble_bits[32] = {};
+    alignas(32) uint8_t _high_nibble_bits[32] = {};
+    bool _has_nibble_tables = false;
+
+    size_t find_scalar(const char* data, size_t len, size_t pos) const;
+    size_t find_sse2(const char* data, size_t len, size_t pos) const;
+    size_t find_avx2(const char* data, size_t len, size_t pos) const;
+};
@@ -0,0 +1,240 @@
+#include "glob.h"
+
+using std::string_view;
+
+GlobPattern::GlobPattern(string_view pattern)
+{
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        char c = pattern[i];
+        if (c == '\\' && i + 1 < pattern.size()) {
+            _tokens.push_back({Token::Kind::Char, pattern[++i]});
+        }
+        else if (c == '*') {
+            /* consecutive stars match the same as one */
+            if (_tokens.empty() || _tokens.back().kind != Token::Kind::Star) {
+                _tokens.push_back({Token::Kind::Star});
+            }
+        }
+        else if (c == '?') {
+            _tokens.push_back({Token::Kind::AnyChar});
+        }
+        else if (c == '[') {
+            size_t end = parse_class(pattern, i);
+            /* an unterminated '[' is literal */
+            if (end == string_view::npos) {
+                _tokens.push_back({Token::Kind::Char, c});
+            }
+            else {
+                i = end;
+            }
+        }
+        else {
+            _tokens.push_back({Token::Kind::Char, c});
+        }
+    }
+
+    /* recognize the simple shapes */
+    size_t n_stars = 0, n_other = 0;
+    for (const Token &token : _tokens) {
+        if (token.kind == Token::Kind::Star) {
+            ++n_stars;
+        }
+        else if (token.kind != Token::Kind::Char) {
+            ++n_other;
+        }
+    }
+    if (n_other > 0 || n_stars > 1) return;
+    size_t literal_start = 0, literal_end = _tokens.size();
+    if (n_stars == 0) {
+        _shape = Shape::Literal;
+    }
+    else if (_tokens.front().kind == Token::Kind::Star) {
+        _shape = Shape::StarLiteral;
+        literal_start = 1;
+    }
+    else if (_tokens.back().kind == Token::Kind::Star) {
+        _shape = Shape::LiteralStar;
+        --literal_end;
+    }
+    else {
+        return;
+    }
+    for (size_t i = literal_start; i < literal_end; ++i) {
+        _literal += _tokens[i].c;
+    }
+}
+
+/**
+ * Compile the bracket expression starting at pattern[pos] ('[').
+ *
+ * @return The position of its closing ']', or npos if there is none (in
+ *         which case nothing is added).
+ */
+size_t GlobPattern::parse_class(string_view pattern, size_t pos)
+{
+    std::bitset<256> chars;
+    size_t i = pos + 1;
+    bool negated = i < pattern.size() &&
+                   (pattern[i] == '!' || pattern[i] == '^');
+    if (negated) ++i;
+
+    /* a ']' right at the start is a member, not the end */
+    for (size_t first = i; i < pattern.size(); ++i) {
+        unsigned char c = pattern[i];
+        if (c == ']' && i > first) break;
+        if (c == '\\' && i + 1 < pattern.size()) c = pattern[++i];
+        if (i + 2 < pattern.size() && pattern[i + 1] == '-' &&
+            pattern[i + 2] != ']') {
+            unsigned char last = pattern[i + 2];
+            for (unsigned hi = c; hi <= last; ++hi) chars.set(hi);
+            i += 2;
+        }
+        else {
+            chars.set(c);
+        }
+    }
+    if (i >= pattern.size()) return string_view::npos;
+
+    if (negated) chars.flip();
+    _tokens.push_back({Token::Kind::Class, 0, _classes.size()});
+    _classes.push_back(chars);
+    return i;
+}
+
+std::string GlobPattern::escape(string_view text)
+{
+    std::string escaped;
+    escaped.reserve(text.size());
+    for (char c : text) {
+        if (c == '\\' || c == '*' || c == '?' || c == '[') escaped += '\\';
+        escaped += c;
+    }
+    return escaped;
+}
+
+bool GlobPattern::matches(string_view text) const
+{
+    switch (_shape) {
+        case Shape::Literal:
+            return text == _literal;
+        case Shape::StarLiteral:
+            return text.size() >= _literal.size() &&
+                   text.substr(text.size() - _literal.size()) == _literal;
+        case Shape::LiteralStar:
+            return text.substr(0, _literal.size()) == _literal;
+        case Shape::General:
+            break;
+    }
+    return matches_tokens(text);
+}
+
+size_t GlobPattern::match_prefix(string_view text, bool longest) const
+{
+    switch (_shape) {
+        case Shape::Literal:
+            return text.substr(0, _literal.size()) == _literal
+                ? _literal.size() : string_view::npos;
+        case Shape::StarLiteral: {
+            size_t pos = longest ? text.rfind(_literal) : text.find(_literal);
+            return pos == string_view::npos ? pos : pos + _literal.size();
+        }
+        case Shape::LiteralStar:
+            if (text.substr(0, _literal.size()) != _literal) {
+                return string_view::npos;
+            }
+            return longest ? text.size() : _literal.size();
+        case Shape::General:
+            break;
+    }
+
+    for (size_t i = 0; i <= text.size(); ++i) {
+        size_t length = longest ? text.size() - i : i;
+        if (matches_tokens(text.substr(0, length))) return length;
+    }
+    return string_view::npos;
+}
+
+size_t GlobPattern::match_suffix(string_view text, bool longest) const
+{
+    bool ends_with_literal = text.size() >= _literal.size() &&
+        text.substr(text.size() - _literal.size()) == _literal;
+    switch (_shape) {
+        case Shape::Literal:
+            return ends_with_literal ? text.size() - _literal.size()
+                                     : string_view::npos;
+        case Shape::StarLiteral:
+            if (!ends_with_literal) return string_view::npos;
+            return longest ? 0 : text.size() - _literal.size();
+        case Shape::LiteralStar:
+            return longest ? text.find(_literal) : text.rfind(_literal);
+        case Shape::General:
+            break;
+    }
+
+    for (size_t i = 0; i <= text.size(); ++i) {
+        size_t pos = longest ? i : text.size() - i;
+        if (matches_tokens(text.substr(pos))) return pos;
+    }
+    return string_view::npos;
+}
+
+bool GlobPattern::find(string_view text, size_t from, size_t &pos,
+                       size_t &length) const
+{
+    if (_shape == Shape::Literal) {
+        if (_literal.empty()) return false;
+        pos = text.find(_literal, from);
+        length = _literal.size();
+        return pos != string_view::npos;
+    }
+    for (pos = from; pos < text.size(); ++pos) {
+        length = match_prefix(text.substr(pos), true);
+        if (length != string_view::npos && length > 0) return true;
+    }
+    return false;
+}
+
+bool GlobPattern::matches_char(const Token &token, char c) const
+{
+    switch (token.kind) {
+        case Token::Kind::Char:
+            return token.c == c;
+        case Token::Kind::AnyChar:
+            return true;
+        case Token::Kind::Class:
+            return _classes[token.class_index].test(
+                static_cast<unsigned char>(c));
+        case Token::Kind::Star:
+            break;
+    }
+    return false;
+}
+
+/**
+ * Match with backtracking to the most recent star only, which suffices
+ * since a later star can absorb anything an earlier one could.
+ */
+bool GlobPattern::matches_tokens(string_view text) const
+{
+    size_t t = 0, p = 0;
+    size_t star = string_view::npos, star_t = 0;
+    while (t < text.size()) {
+        if (p < _tokens.size() && _tokens[p].kind == Token::Kind::Star) {
+            star = p++;
+            star_t = t;
+        }
+        else if (p < _tokens.size() && matches_char(_tokens[p], text[t])) {
+            ++p;
+            ++t;
+        }
+        else if (star != string_view::npos) {
+            p = star + 1;
+            t = ++star_t;
+        }
+        else {
+            return false;
+        }
+    }
+    while (p < _tokens.size() && _tokens[p].kind == Token::Kind::Star) ++p;
+    return p == _tokens.size();
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <bitset>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * A shell glob pattern ('*', '?', and bracket expressions like [a-z] or
+ * [!0-9]; a backslash makes the next character literal), compiled once and
+ * then matched against any number of strings.
+ *
+ * Patterns are compiled into a sequence of single-character matchers and
+ * stars. The shapes that parameter expansion uses most, a literal string
+ * alone, or preceded or followed by one star ('*.txt', 'tmp*'), are also
+ * recognized, and matched with plain string searches instead.
+ */
+class GlobPattern {
+  public:
+    /** @param pattern The pattern, with backslash escapes. */
+    GlobPattern(std::string_view pattern);
+
+    /** Returns 'text' with backslashes added, to match it literally. */
+    static std::string escape(std::string_view text);
+
+    /** Returns 'true' if the pattern matches all of 'text'. */
+    bool matches(std::string_view text) const;
+
+    /**
+     * Returns the length of the shortest (or longest) prefix of 'text' that
+     * the pattern matches, or std::string_view::npos if there is none.
+     */
+    size_t match_prefix(std::string_view text, bool longest) const;
+
+    /**
+     * Returns the position of the shortest (or longest) suffix of 'text' that
+     * the pattern matches, or std::string_view::npos if there is none.
+     */
+    size_t match_suffix(std::string_view text, bool longest) const;
+
+    /**
+     * Find the first non-empty match in 'text' at or after 'from' (the
+     * longest one at that position).
+     *
+     * @return 'false' if there is none; otherwise 'true', with the match in
+     *         'pos' and 'length'.
+     */
+    bool find(std::string_view text, size_t from, size_t &pos,
+              size_t &length) const;
+
+  private:
+    struct Token {
+        enum class Kind { Char, AnyChar, Class, Star };
+
+        Kind kind;
+        char c = 0;
+        /* index into _classes, for Kind::Class */
+        size_t class_index = 0;
+    };
+
+    enum class Shape {
+        Literal,      // no wildcards: _literal
+        StarLiteral,  // '*' followed by _literal
+        LiteralStar,  // _literal followed by '*'
+        General,
+    };
+
+    std::vector<Token> _tokens;
+    std::vector<std::bitset<256>> _classes;
+    Shape _shape = Shape::General;
+    std::string _literal;
+
+    bool matches_tokens(std::string_view text) const;
+    bool matches_char(const Token &token, char c) const;
+    size_t parse_class(std::string_view pattern, size_t pos);
+};
@@ -0,0 +1,66 @@
+#pragma once
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+/**
+ * A fixed-capacity map that evicts its least recently used entry when full.
+ * Both lookups and insertions count as uses.
+ */
+template <typename Key, typename Value>
+class LRUCache {
+  public:
+    LRUCache(size_t capacity) : _capacity(capacity) {}
+
+    /**
+     * Returns a pointer to the value cached for 'key' and marks it as most
+     * recently used, or nullptr if there is none. The pointer is valid until
+     * the next insertion.
+     */
+    Value* get(const Key& key) {
+        auto it = _index.find(key);
+        if (it == _index.end()) return nullptr;
+        _entries.splice(_entries.begin(), _entries, it->second);
+        return &it->second->second;
+    }
+
+    /**
+     * Cache 'value' for 'key', replacing any previous value and evicting the
+     * least recently used entry if the cache is full.
+     */
+    void put(const Key& key, Value value) {
+        if (_capacity == 0) return;
+        /* replace by erasing first, since the key may refer into the value */
+        auto it = _index.find(key);
+        if (it != _index.end()) {
+            _entries.erase(it->second);
+            _index.erase(it);
+        }
+        else if (_entries.size() == _capacity) {
+            _index.erase(_entries.back().first);
+            _entries.pop_back();
+        }
+        _entries.emplace_front(key, std::move(value));
+        _index[_entries.front().first] = _entries.begin();
+    }
+
+    /** Change the capacity, evicting entries as necessary. */
+    void set_capacity(size_t capacity) {
+        _capacity = capacity;
+        while (_entries.size() > _capacity) {
+            _index.erase(_entries.back().first);
+            _entries.pop_back();
+        }
+    }
+
+    size_t size() const { return _entries.size(); }
+    void clear() { _entries.clear(); _index.clear(); }
+
+  private:
+    using Entry = std::pair<Key, Value>;
+
+    size_t _capacity;
+    std::list<Entry> _entries; // most recently used first
+    std::unordered_map<Key, typename std::list<Entry>::iterator> _index;
+};